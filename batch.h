@@ -0,0 +1,209 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <vector>
+#include <string>
+#include <istream>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+
+#include <pthread.h>
+
+// Line-oriented batch processing on a fixed pool of threads. Input lines
+// are read in chunks; the workers process the lines of a chunk in small
+// grains claimed with an atomic counter, while the calling thread writes
+// the results of the previous chunk and reads the next one. Results are
+// written in input order, one line per input line.
+//
+// Every pool thread owns one Worker, which is its scratch state; a
+// Worker is default-constructible and provides
+//   void operator()(const std::string& In, std::string& Out)
+// which must not touch state shared with other Workers.
+
+static const size_t BatchChunkLines = 8192UL;
+static const size_t BatchGrain = 16UL;
+
+struct batch_chunk {
+  batch_chunk() : In(BatchChunkLines), Out(BatchChunkLines), Count(0UL) { }
+
+  std::vector<std::string> In;
+  std::vector<std::string> Out;
+  size_t Count;
+};
+
+class batch_pool_base {
+public:
+  virtual ~batch_pool_base() { }
+  virtual void WorkerLoop() = 0;
+};
+
+extern "C" {
+  static void* batch_thread_start(void* Arg) {
+    static_cast<batch_pool_base*>(Arg)->WorkerLoop();
+    return NULL;
+  }
+}
+
+template<typename Worker>
+class BatchPool : public batch_pool_base {
+public:
+  explicit BatchPool(uint32_t Threads) : NT(Threads ? Threads : 1U),
+    TID(NT), Current(NULL), Generation(0UL), Finished(0U), Quit(false),
+    Next(0UL) {
+    (void) pthread_mutex_init(&Mutex, NULL);
+    (void) pthread_cond_init(&Start, NULL);
+    (void) pthread_cond_init(&Done, NULL);
+
+    for (uint32_t I = 0U; I < NT; ++I)
+      (void) pthread_create(&TID[I], NULL, batch_thread_start, this);
+  }
+
+  ~BatchPool() {
+    pthread_mutex_lock(&Mutex);
+    Quit = true;
+    pthread_cond_broadcast(&Start);
+    pthread_mutex_unlock(&Mutex);
+
+    for (uint32_t I = 0U; I < NT; ++I)
+      (void) pthread_join(TID[I], NULL);
+
+    (void) pthread_cond_destroy(&Done);
+    (void) pthread_cond_destroy(&Start);
+    (void) pthread_mutex_destroy(&Mutex);
+  }
+
+  // Processes every line of In and writes the results to Out. Returns
+  // the number of lines processed.
+  uint64_t Run(std::istream& In, std::FILE* Out) {
+    batch_chunk C[2];
+    size_t Cur = 0UL;
+    bool Pending = false;
+    uint64_t Lines = 0UL;
+    std::string Buffer;
+
+    for (;;) {
+      // The workers are busy with the other chunk meanwhile.
+      batch_chunk& R = C[Cur];
+      R.Count = 0UL;
+      while (R.Count < BatchChunkLines && std::getline(In, R.In[R.Count]))
+        ++R.Count;
+
+      if (Pending)
+        Wait();
+
+      if (R.Count)
+        Dispatch(&R);
+
+      if (Pending)
+        Write(C[Cur ^ 1UL], Out, Buffer);
+
+      Lines += R.Count;
+      Pending = R.Count != 0UL;
+      Cur ^= 1UL;
+
+      if (!Pending)
+        break;
+    }
+
+    (void) std::fflush(Out);
+    return Lines;
+  }
+
+  void WorkerLoop() {
+    Worker W;
+    uint64_t Seen = 0UL;
+
+    for (;;) {
+      pthread_mutex_lock(&Mutex);
+      while (Generation == Seen && !Quit)
+        pthread_cond_wait(&Start, &Mutex);
+
+      if (Quit) {
+        pthread_mutex_unlock(&Mutex);
+        break;
+      }
+
+      Seen = Generation;
+      batch_chunk* C = Current;
+      pthread_mutex_unlock(&Mutex);
+
+      for (;;) {
+        size_t B = Next.fetch_add(BatchGrain, std::memory_order_relaxed);
+        if (B >= C->Count)
+          break;
+
+        size_t E = B + BatchGrain < C->Count ? B + BatchGrain : C->Count;
+        for (size_t I = B; I < E; ++I)
+          W(C->In[I], C->Out[I]);
+      }
+
+      pthread_mutex_lock(&Mutex);
+      if (++Finished == NT)
+        pthread_cond_signal(&Done);
+      pthread_mutex_unlock(&Mutex);
+    }
+  }
+
+private:
+  BatchPool(const BatchPool&) = delete;
+  BatchPool& operator=(const BatchPool&) = delete;
+
+  void Dispatch(batch_chunk* C) {
+    pthread_mutex_lock(&Mutex);
+    Current = C;
+    Next.store(0UL, std::memory_order_relaxed);
+    Finished = 0U;
+    ++Generation;
+    pthread_cond_broadcast(&Start);
+    pthread_mutex_unlock(&Mutex);
+  }
+
+  void Wait() {
+    pthread_mutex_lock(&Mutex);
+    while (Finished < NT)
+      pthread_cond_wait(&Done, &Mutex);
+    pthread_mutex_unlock(&Mutex);
+  }
+
+  static void Write(const batch_chunk& C, std::FILE* Out, std::string& B) {
+    B.clear();
+
+    for (size_t I = 0UL; I < C.Count; ++I) {
+      B += C.Out[I];
+      B += '\n';
+    }
+
+    (void) std::fwrite(B.data(), 1UL, B.size(), Out);
+  }
+
+  uint32_t NT;
+  std::vector<pthread_t> TID;
+  batch_chunk* Current;
+  uint64_t Generation;
+  uint32_t Finished;
+  bool Quit;
+  std::atomic<size_t> Next;
+  pthread_mutex_t Mutex;
+  pthread_cond_t Start;
+  pthread_cond_t Done;
+};
+
+#endif // BATCH_H
@@ -0,0 +1,296 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#ifndef FACTORCACHE_H
+#define FACTORCACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gmp.h>
+
+// Persistent factorization cache: an append-only hash table in a file
+// that is mapped read-only and shared by any number of processes.
+//
+// The file is a header, a fixed array of CacheBuckets chain heads and the
+// records, each appended at the end of the file and linked in front of
+// its bucket's chain. A record is never changed once written, so a newer
+// result for the same N (a partial factorization taken further) shadows
+// the older one. The key is the binary value of N (mpz_export, most
+// significant byte first); the value is the caller's text.
+//
+// Readers hold a shared flock(2) and writers an exclusive one. A record
+// is written with pwrite(2), then the header's end offset is advanced
+// past it, and only then is the chain head pointed at it, so a crash
+// leaves at most unreferenced bytes behind. Readers only follow offsets
+// that lie in the data area below the end and that decrease along a
+// chain, so even a damaged file cannot make a lookup loop.
+// Within a process, a mutex serializes the threads, which share one
+// open file description and hence one flock.
+
+static const char CacheMagic[8] = { 'P', 'F', 'C', 'A', 'C', 'H', 'E', '1' };
+static const uint64_t CacheBuckets = 1UL << 16;
+
+struct cache_header {
+  char Magic[8];
+  uint64_t Buckets;
+  uint64_t End;
+  uint64_t Records;
+};
+
+struct cache_record {
+  uint64_t Next;
+  uint64_t Hash;
+  uint32_t KeySize;
+  uint32_t ValueSize;
+};
+
+class FactorCache {
+public:
+  FactorCache() : FD(-1), Base(NULL), Mapped(0UL), Key(), Record() {
+    (void) pthread_mutex_init(&Mutex, NULL);
+  }
+
+  ~FactorCache() {
+    if (Base)
+      (void) munmap(Base, Mapped);
+    if (FD >= 0)
+      (void) close(FD);
+    (void) pthread_mutex_destroy(&Mutex);
+  }
+
+  // Opens or creates the cache file at Path. Returns false with errno
+  // set on a system error, or with errno 0 if Path is not a cache.
+  bool Open(const char* Path) {
+    FD = open(Path, O_RDWR | O_CREAT, 0644);
+    if (FD < 0)
+      return false;
+
+    if (flock(FD, LOCK_EX) != 0)
+      return false;
+
+    struct stat ST;
+    bool Ok = fstat(FD, &ST) == 0;
+
+    if (Ok && ST.st_size == 0) {
+      cache_header H;
+      std::memcpy(H.Magic, CacheMagic, sizeof(CacheMagic));
+      H.Buckets = CacheBuckets;
+      H.End = DataOffset();
+      H.Records = 0UL;
+
+      Ok = ftruncate(FD, (off_t) H.End) == 0 &&
+        pwrite(FD, &H, sizeof(H), 0) == (ssize_t) sizeof(H);
+    }
+
+    if (Ok) {
+      Ok = Remap();
+      if (Ok && (std::memcmp(Header()->Magic, CacheMagic,
+                             sizeof(CacheMagic)) != 0 ||
+                 Header()->Buckets != CacheBuckets ||
+                 Header()->End > Mapped)) {
+        errno = 0;
+        Ok = false;
+      }
+    }
+
+    int E = errno;
+    (void) flock(FD, LOCK_UN);
+    errno = E;
+    return Ok;
+  }
+
+  // Looks up N. Returns true and sets Value if N is in the cache.
+  bool Find(const mpz_t& N, std::string& Value) {
+    bool Found = false;
+
+    pthread_mutex_lock(&Mutex);
+    Export(N);
+    uint64_t H = Hash();
+    (void) flock(FD, LOCK_SH);
+
+    if (Remap()) {
+      uint64_t End = Header()->End < Mapped ? Header()->End : Mapped;
+      uint64_t O = Heads()[H & (CacheBuckets - 1UL)];
+
+      while (O >= DataOffset() && O < End &&
+             O + sizeof(cache_record) <= End) {
+        cache_record R;
+        std::memcpy(&R, Base + O, sizeof(R));
+
+        const char* K = Base + O + sizeof(R);
+        if (O + sizeof(R) + R.KeySize + R.ValueSize > End)
+          break;
+
+        if (R.Hash == H && R.KeySize == Key.size() &&
+            std::memcmp(K, Key.data(), Key.size()) == 0) {
+          Value.assign(K + R.KeySize, R.ValueSize);
+          Found = true;
+          break;
+        }
+
+        // Older records lie below; anything else is damage.
+        End = O;
+        O = R.Next;
+      }
+    }
+
+    (void) flock(FD, LOCK_UN);
+    pthread_mutex_unlock(&Mutex);
+    return Found;
+  }
+
+  // Appends the record N -> Value. Returns false on a write error.
+  bool Insert(const mpz_t& N, const std::string& Value) {
+    bool Ok = false;
+
+    pthread_mutex_lock(&Mutex);
+    Export(N);
+    uint64_t H = Hash();
+    (void) flock(FD, LOCK_EX);
+
+    if (Remap()) {
+      cache_header CH;
+      std::memcpy(&CH, Base, sizeof(CH));
+      uint64_t* Head = Heads() + (H & (CacheBuckets - 1UL));
+
+      cache_record R;
+      R.Next = *Head;
+      R.Hash = H;
+      R.KeySize = (uint32_t) Key.size();
+      R.ValueSize = (uint32_t) Value.size();
+
+      size_t S = sizeof(R) + Key.size() + Value.size();
+      Record.assign((S + 7UL) & ~7UL, '\0');
+      std::memcpy(&Record[0], &R, sizeof(R));
+      std::memcpy(&Record[sizeof(R)], Key.data(), Key.size());
+      std::memcpy(&Record[sizeof(R) + Key.size()], Value.data(),
+                  Value.size());
+
+      uint64_t O = CH.End;
+      uint64_t HO = (uint64_t) ((const char*) Head - Base);
+
+      CH.End = O + Record.size();
+      ++CH.Records;
+
+      Ok = Write(Record.data(), Record.size(), O) &&
+        Write(&CH, sizeof(CH), 0UL) && Write(&O, sizeof(O), HO);
+    }
+
+    (void) flock(FD, LOCK_UN);
+    pthread_mutex_unlock(&Mutex);
+    return Ok;
+  }
+
+private:
+  FactorCache(const FactorCache&) = delete;
+  FactorCache& operator=(const FactorCache&) = delete;
+
+  static inline uint64_t DataOffset() {
+    return sizeof(cache_header) + CacheBuckets * sizeof(uint64_t);
+  }
+
+  inline const cache_header* Header() const {
+    return reinterpret_cast<const cache_header*>(Base);
+  }
+
+  inline uint64_t* Heads() const {
+    return reinterpret_cast<uint64_t*>(Base + sizeof(cache_header));
+  }
+
+  // Maps the whole file again if another writer has grown it.
+  bool Remap() {
+    struct stat ST;
+    if (fstat(FD, &ST) != 0)
+      return false;
+
+    size_t S = (size_t) ST.st_size;
+    if (S == Mapped)
+      return true;
+
+    if (Base)
+      (void) munmap(Base, Mapped);
+
+    void* B = mmap(NULL, S, PROT_READ, MAP_SHARED, FD, 0);
+    if (B == MAP_FAILED) {
+      Base = NULL;
+      Mapped = 0UL;
+      return false;
+    }
+
+    Base = static_cast<char*>(B);
+    Mapped = S;
+    return true;
+  }
+
+  bool Write(const void* P, size_t S, uint64_t O) {
+    const char* C = static_cast<const char*>(P);
+
+    while (S) {
+      ssize_t W = pwrite(FD, C, S, (off_t) O);
+      if (W < 0 && errno == EINTR)
+        continue;
+      if (W <= 0)
+        return false;
+
+      C += W;
+      S -= (size_t) W;
+      O += (uint64_t) W;
+    }
+
+    return true;
+  }
+
+  void Export(const mpz_t& N) {
+    Key.resize((mpz_sizeinbase(N, 2) + 7UL) / 8UL);
+    size_t C = 0UL;
+    (void) mpz_export(&Key[0], &C, 1, 1, 1, 0, N);
+    Key.resize(C);
+  }
+
+  // FNV-1a.
+  uint64_t Hash() const {
+    uint64_t H = 14695981039346656037UL;
+
+    for (size_t I = 0UL; I < Key.size(); ++I) {
+      H ^= (uint8_t) Key[I];
+      H *= 1099511628211UL;
+    }
+
+    return H;
+  }
+
+  int FD;
+  char* Base;
+  size_t Mapped;
+  std::string Key;
+  std::string Record;
+  pthread_mutex_t Mutex;
+};
+
+#endif // FACTORCACHE_H
@@ -17,7 +17,8 @@
 
 #include <iostream>
 #include <vector>
-#include <set>
+#include <string>
+#include <algorithm>
 #include <cstdint>
 #include <cmath>
 #include <ctime>
@@ -29,28 +30,71 @@
 #include <sys/select.h>
 #include <gmp.h>
 
-struct MPZ {
-  MPZ(const mpz_t& X, uint32_t Bits) : MPV() {
-    mpz_init2(MPV, Bits);
-    mpz_set(MPV, X);
-  }
+#include "fixedmp.h"
+#include "prodtree.h"
 
-  mpz_t MPV;
-};
+// Per-thread prime storage. Every prime is stored as a packed, fixed-width
+// array of Limbs limbs (the width comes from -b) inside arena chunks of
+// ChunkPrimes entries. A thread scans its range in ascending order, so each
+// arena is sorted, and the ranges themselves are disjoint and ascending:
+// the final list is simply the concatenation of all the arenas.
+struct prime_arena {
+  static constexpr size_t ChunkPrimes = 4096UL;
+
+  prime_arena() : Chunks(), Count(0UL), Limbs(0UL) { }
+
+  void Append(const mpz_t& X) {
+    size_t CI = Count % ChunkPrimes;
+
+    if (CI == 0UL)
+      Chunks.push_back(new mp_limb_t[ChunkPrimes * Limbs]);
+
+    mp_limb_t* D = Chunks.back() + CI * Limbs;
+    size_t XS = mpz_size(X);
+    std::memcpy(D, mpz_limbs_read(X), XS * sizeof(mp_limb_t));
+    std::memset(D + XS, 0, (Limbs - XS) * sizeof(mp_limb_t));
+    ++Count;
+  }
 
-template<typename T>
-struct mpz_less : public std::binary_function<T, T, bool> {
-public:
-  constexpr inline bool operator()(const T& L, const T& R) const {
-    return mpz_cmp(L->MPV, R->MPV) < 0;
+  inline const mp_limb_t* At(size_t I) const {
+    return Chunks[I / ChunkPrimes] + (I % ChunkPrimes) * Limbs;
   }
+
+  std::vector<mp_limb_t*> Chunks;
+  size_t Count;
+  size_t Limbs;
 };
 
 static std::string RangeStart = "18446744073709551615";
 static std::string RangeEnd;
 static uint32_t NThreads = 4U;
 static uint32_t Bits = 128U;
-static std::set<MPZ*, mpz_less<MPZ*>> PrimeStorage;
+static uint32_t PrimeBound = static_cast<uint32_t>(~0x0);
+static mpz_t SmallPrimorial;
+static const size_t BatchSize = 256UL;
+
+enum search_mode {
+  ModeRange,
+  ModeNext,
+  ModePrev,
+  ModeRandom,
+  ModeSafe,
+  ModeProth,
+  ModeRiesel
+};
+
+static search_mode Mode = ModeRange;
+static uint64_t RandomCount = 1UL;
+static std::string RandomSeed;
+static bool ExactBits = false;
+static uint64_t Residue = 0UL;
+static uint64_t Modulus = 1UL;
+static uint64_t KMin = 0UL;
+static uint64_t KMax = 0UL;
+static uint64_t NMin = 0UL;
+static uint64_t NMax = 0UL;
+static const char* CheckpointFile = NULL;
+static std::vector<prime_arena> PrimeStorage;
 static bool PrintHeader = false;
 static bool PrintTimestamp = false;
 static struct timespec ts_begin = { 0, 0 };
@@ -112,8 +156,29 @@ static void PrintHelp() {
   std::cerr << "Usage: findprimesmp -s <range-start> "
     << "(default 18446744073709551615)" << std::endl;
   std::cerr << "                    -e <range-end>" << std::endl;
+  std::cerr << "       findprimesmp -m next -s <X> (first prime > X)" << std::endl;
+  std::cerr << "       findprimesmp -m prev -s <X> (last prime < X)" << std::endl;
+  std::cerr << "       findprimesmp -m random -b <prime-bits> "
+    << "[ -c <count> (default 1)]" << std::endl;
+  std::cerr << "                    [ -S <seed> (default /dev/urandom)]"
+    << std::endl;
+  std::cerr << "                    [ -x (exactly <prime-bits> bits)]"
+    << std::endl;
+  std::cerr << "                    [ -r <a>:<m> (primes = a mod m)]"
+    << std::endl;
+  std::cerr << "       findprimesmp -m safe -b <prime-bits> (safe primes 2q+1)"
+    << std::endl;
+  std::cerr << "                    [ -c <count>] [ -S <seed>] [ -x]"
+    << std::endl;
+  std::cerr << "       findprimesmp -m proth|riesel -k <k>[:<k-max>] "
+    << "-n <n>[:<n-max>]" << std::endl;
+  std::cerr << "                    (sieve k*2^n+1 or k*2^n-1, one range)"
+    << std::endl;
+  std::cerr << "                    [ -C <checkpoint-file>]" << std::endl;
   std::cerr << "       [ -b <number-of-bits> (default 128)]" << std::endl;
   std::cerr << "       [ -T <number-of-threads> (default 4)]" << std::endl;
+  std::cerr << "       [ -B <small-prime-bound> (default by size, 0 = off)]"
+    << std::endl;
   std::cerr << "       [ -f <output-file> (default stdout)]" << std::endl;
   std::cerr << "       [ -p (print header at the top)]" << std::endl;
   std::cerr << "       [ -t (print prime discovery time)]" << std::endl;
@@ -127,6 +192,16 @@ static void Timestamp(struct timespec* ts) {
   }
 }
 
+static size_t PrimeCount() {
+  size_t C = 0UL;
+
+  for (std::vector<prime_arena>::const_iterator AI = PrimeStorage.begin();
+       AI != PrimeStorage.end(); ++AI)
+    C += (*AI).Count;
+
+  return C;
+}
+
 static void PrintTime(const char* Filename) {
   FILE* fp = NULL;
   if (Filename) {
@@ -149,7 +224,7 @@ static void PrintTime(const char* Filename) {
 
   (void) std::fprintf(fp, "-----\n");
   (void) std::fprintf(fp, "Discovered %lu prime numbers in %lu.%.16lu seconds.\n",
-                      PrimeStorage.size(), sec, nns);
+                      PrimeCount(), sec, nns);
   (void) std::fflush(fp);
 
   if (Filename)
@@ -157,10 +232,14 @@ static void PrintTime(const char* Filename) {
 }
 
 static void Cleanup() {
-  for (std::set<MPZ*>::const_iterator PI = PrimeStorage.begin();
-       PI != PrimeStorage.end(); ++PI) {
-    mpz_clear((*PI)->MPV);
-    delete *PI;
+  for (std::vector<prime_arena>::iterator AI = PrimeStorage.begin();
+       AI != PrimeStorage.end(); ++AI) {
+    for (std::vector<mp_limb_t*>::iterator CI = (*AI).Chunks.begin();
+         CI != (*AI).Chunks.end(); ++CI)
+      delete [] *CI;
+
+    (*AI).Chunks.clear();
+    (*AI).Count = 0UL;
   }
 }
 
@@ -181,11 +260,9 @@ static int CheckBits(uint32_t bits) {
   return 0;
 }
 
-void AddPrime(const mpz_t& X) {
-  MPZ* M = new MPZ(X, Bits);
-  (void) pthread_mutex_lock(&mutex);
-  PrimeStorage.insert(M);
-  (void) pthread_mutex_unlock(&mutex);
+// No locking: every thread only ever appends to its own arena.
+void AddPrime(uint32_t TId, const mpz_t& X) {
+  PrimeStorage[TId].Append(X);
 }
 
 static int PrintPrimes(const char* Filename) {
@@ -205,12 +282,17 @@ static int PrintPrimes(const char* Filename) {
     (void) std::fprintf(fp, "List of prime numbers in the range %s - %s:\n\n",
                         RangeStart.c_str(), RangeEnd.c_str());
 
-  for (std::set<MPZ*>::const_iterator PI = PrimeStorage.begin();
-       PI != PrimeStorage.end(); ++PI) {
-    char* P = mpz_get_str(NULL, 10, (*PI)->MPV);
-    (void) std::fprintf(fp, "%s\n", P);
-    mp_get_memory_functions(NULL, NULL, &gmp_free_mem_func);
-    gmp_free_mem_func(P, std::strlen(P) + 1);
+  mp_get_memory_functions(NULL, NULL, &gmp_free_mem_func);
+
+  for (std::vector<prime_arena>::const_iterator AI = PrimeStorage.begin();
+       AI != PrimeStorage.end(); ++AI) {
+    for (size_t I = 0UL; I < (*AI).Count; ++I) {
+      mpz_t V;
+      mpz_roinit_n(V, (*AI).At(I), (*AI).Limbs);
+      char* P = mpz_get_str(NULL, 10, V);
+      (void) std::fprintf(fp, "%s\n", P);
+      gmp_free_mem_func(P, std::strlen(P) + 1);
+    }
   }
 
   (void) std::fflush(fp);
@@ -230,15 +312,50 @@ extern "C" {
     mpz_init2(P, Bits);
     mpz_set(P, PR->Start);
 
+    // Candidates are screened in batches against the primorial of the
+    // primes up to -B; only the ones without a small factor get the
+    // full probable-prime test.
+    mpz_t* X = new mpz_t[BatchSize];
+    mpz_t* G = new mpz_t[BatchSize];
+    ProductTree T;
+
+    for (size_t I = 0UL; I < BatchSize; ++I) {
+      mpz_init2(X[I], Bits);
+      mpz_init2(G[I], Bits);
+    }
+
     while (mpz_cmp(P, PR->End) <= 0) {
-      if (IsPrime(P)) {
-        AddPrime(P);
-        ++PC;
+      size_t N = 0UL;
+
+      while (N < BatchSize && mpz_cmp(P, PR->End) <= 0) {
+        mpz_set(X[N++], P);
+        mpz_add_ui(P, P, 2UL);
       }
 
-      mpz_add_ui(P, P, 2UL);
+      if (PrimeBound)
+        BatchSmallFactors(T, X, N, SmallPrimorial, G);
+
+      for (size_t I = 0UL; I < N; ++I) {
+        if (PrimeBound && mpz_cmp_ui(G[I], 1UL) != 0 &&
+            mpz_cmp(G[I], X[I]) != 0)
+          continue;
+
+        if (IsPrime(X[I])) {
+          AddPrime(PR->TId, X[I]);
+          ++PC;
+        }
+      }
     }
 
+    for (size_t I = 0UL; I < BatchSize; ++I) {
+      mpz_clear(X[I]);
+      mpz_clear(G[I]);
+    }
+
+    delete [] X;
+    delete [] G;
+    mpz_clear(P);
+
     char* PS = mpz_get_str(NULL, 10, PR->Start);
     char* PE = mpz_get_str(NULL, 10, PR->End);
     (void) std::fprintf(stderr, "thread %u [%s -> %s] is done [%u].\n",
@@ -282,81 +399,13 @@ extern "C" {
   }
 }
 
+// 1 is listed as a prime, like findprimes does. Everything else goes to
+// the probable-prime test, on the fixed-width fast path for -b <= 512.
 bool IsPrime(const mpz_t& X) {
-  if (char* P = mpz_get_str(NULL, 10, X)) {
-    size_t SL = std::strlen(P);
-
-    if (SL == 0UL)
-      return false;
-    else if (SL == 1UL && (P[0] == '1' || P[0] == '2'))
-      return true;
-
-    switch (P[SL - 1]) {
-    case '0':
-    case '2':
-    case '4':
-    case '6':
-    case '8':
-      mp_get_memory_functions(NULL, NULL, &gmp_free_mem_func);
-      gmp_free_mem_func(P, std::strlen(P) + 1);
-      return false;
-      break;
-    case '5':
-      return SL == 1UL;
-      break;
-    default:
-      break;
-    }
-
-    mp_get_memory_functions(NULL, NULL, &gmp_free_mem_func);
-    gmp_free_mem_func(P, std::strlen(P) + 1);
-    bool NP = false;
-
-    mpz_t SQRT;
-    mpz_t ON;
-    mpz_init2(SQRT, Bits);
-    mpz_init2(ON, Bits);
-
-    mpz_set_ui(ON, 1UL);
-    mpz_sqrt(SQRT, X);
-    mpz_add(SQRT, ON, SQRT);
+  if (mpz_cmp_ui(X, 1UL) == 0)
+    return true;
 
-    mpz_t I;
-    mpz_t R;
-    mpz_t T;
-    mpz_t Z;
-
-    mpz_init2(I, Bits);
-    mpz_init2(R, Bits);
-    mpz_init2(T, Bits);
-    mpz_init2(Z, Bits);
-
-    mpz_set_ui(I, 3UL);
-    mpz_set_ui(T, 2UL);
-    mpz_set_ui(Z, 0UL);
-
-    while (mpz_cmp(SQRT, I) > 0) {
-      mpz_mod(R, X, I);
-
-      if (mpz_cmpabs(R, Z) == 0) {
-        NP = true;
-        break;
-      }
-
-      mpz_add(I, T, I);
-    }
-
-    mpz_clear(Z);
-    mpz_clear(T);
-    mpz_clear(R);
-    mpz_clear(I);
-    mpz_clear(ON);
-    mpz_clear(SQRT);
-
-    return !NP;
-  }
-
-  return false;
+  return IsProbablePrimeMP(X, Bits);
 }
 
 void AdjustRanges() {
@@ -382,7 +431,19 @@ void AdjustRanges() {
   case '4':
   case '6':
   case '8':
-    RangeEnd[SL - 1] = RangeEnd[SL - 1] + 1;
+    // Down, so that no prime above the given end is reported.
+    if (RangeEnd != "0") {
+      mpz_t E;
+      mpz_init_set_str(E, RangeEnd.c_str(), 10);
+      mpz_sub_ui(E, E, 1UL);
+
+      char* ES = mpz_get_str(NULL, 10, E);
+      RangeEnd = ES;
+      mp_get_memory_functions(NULL, NULL, &gmp_free_mem_func);
+      gmp_free_mem_func(ES, std::strlen(ES) + 1);
+      mpz_clear(E);
+    }
+
     std::cerr << "range upper bound adjusted to " << RangeEnd
       << '.' << std::endl;
     break;
@@ -434,6 +495,8 @@ void FindPrimes() {
   mpz_add(RRE, RS, Q);
   mpz_set(ranges[0].End, RRE);
 
+  // The ranges must not overlap: the per-thread arenas are concatenated
+  // as they are, without any de-duplication.
   uint32_t i;
   for (i = 1; i < NThreads - 1; ++i) {
     mpz_set(ranges[i].Start, ranges[i - 1].End);
@@ -445,26 +508,61 @@ void FindPrimes() {
       mpz_add(ranges[i].End, ON, ranges[i].End);
 
     if (mpz_fdiv_ui(ranges[i].Start, 2UL) == 0UL)
-      mpz_sub(ranges[i].Start, ranges[i].Start, ON);
+      mpz_add(ranges[i].Start, ranges[i].Start, ON);
   }
 
   mpz_set(ranges[NThreads - 1].Start, ranges[i - 1].End);
+  mpz_add(ranges[NThreads - 1].Start, ON, ranges[NThreads - 1].Start);
   if (mpz_fdiv_ui(ranges[NThreads - 1].Start, 2UL) == 0UL)
-    mpz_sub(ranges[NThreads - 1].Start, ranges[i].Start, ON);
+    mpz_add(ranges[NThreads - 1].Start, ranges[NThreads - 1].Start, ON);
 
   mpz_set(ranges[NThreads - 1].End, RE);
 
+  // Rounding to odd bounds can carry a narrow range past -e; the ranges
+  // past the end are left empty (Start > End), and their threads test
+  // nothing.
+  for (i = 0; i < NThreads; ++i) {
+    if (mpz_cmp(ranges[i].End, RE) > 0)
+      mpz_set(ranges[i].End, RE);
+  }
+
   for (i = 0; i < NThreads; ++i) {
     char* PS = mpz_get_str(NULL, 10, ranges[i].Start);
     char* PE = mpz_get_str(NULL, 10, ranges[i].End);
-    (void) std::fprintf(stderr, "range[%u]: %s --> %s\n", i, PS, PE);
+    (void) std::fprintf(stderr, "range[%u]: %s --> %s%s\n", i, PS, PE,
+                        mpz_cmp(ranges[i].Start, ranges[i].End) > 0 ?
+                        " (empty)" : "");
     mp_get_memory_functions(NULL, NULL, &gmp_free_mem_func);
     gmp_free_mem_func(PS, std::strlen(PS) + 1);
     gmp_free_mem_func(PE, std::strlen(PE) + 1);
   }
 
+  mpz_init(SmallPrimorial);
+
+  // Batch screening only pays for itself once the probable-prime test
+  // gets expensive: below 512 bits it costs more than it saves.
+  if (PrimeBound == static_cast<uint32_t>(~0x0)) {
+    size_t RB = mpz_sizeinbase(RE, 2);
+    PrimeBound = RB < 512UL ? 0U : RB <= 1024UL ? 16384U : 65536U;
+  }
+
+  if (PrimeBound) {
+    std::vector<uint32_t> SP;
+    SievePrimes(PrimeBound, SP);
+    Primorial(SmallPrimorial, SP);
+  }
+
   tattr.resize(NThreads);
   threads.resize(NThreads);
+  PrimeStorage.resize(NThreads);
+
+  // The range end may be wider than -b; the arena entries must not be.
+  size_t Limbs = (Bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+  if (mpz_size(RE) > Limbs)
+    Limbs = mpz_size(RE);
+
+  for (i = 0; i < NThreads; ++i)
+    PrimeStorage[i].Limbs = Limbs;
 
   for (i = 0; i < NThreads; ++i) {
     (void) pthread_attr_init(&tattr[i]);
@@ -497,6 +595,1055 @@ void FindPrimes() {
   mpz_clear(RS);
   mpz_clear(R);
   mpz_clear(Q);
+  mpz_clear(SmallPrimorial);
+}
+
+// Modular inverse of A modulo an odd prime P, A != 0 mod P.
+static uint64_t InvMod(uint64_t A, uint64_t P) {
+  int64_t T0 = 0L;
+  int64_t T1 = 1L;
+  uint64_t R0 = P;
+  uint64_t R1 = A % P;
+
+  while (R1 != 0UL) {
+    uint64_t Q = R0 / R1;
+    uint64_t R = R0 - Q * R1;
+    int64_t T = T0 - (int64_t) Q * T1;
+    R0 = R1;
+    R1 = R;
+    T0 = T1;
+    T1 = T;
+  }
+
+  return T0 < 0L ? (uint64_t) (T0 + (int64_t) P) : (uint64_t) T0;
+}
+
+// A window of W candidates Base + Dir * K * Step, K = 0 .. W - 1. On
+// return, Composite[K] is set when candidate K is divisible by one of
+// the sieving primes (and is not that prime itself). Primes dividing
+// Step are skipped: they divide either every candidate or none.
+static void SieveWindow(const mpz_t& Base, int Dir, uint64_t Step, size_t W,
+                        const std::vector<uint32_t>& Primes,
+                        std::vector<uint8_t>& Composite) {
+  Composite.assign(W, 0);
+
+  if (Primes.empty())
+    return;
+
+  // Only a window this close to zero can contain the sieving primes.
+  bool Small = mpz_cmp_ui(Base, Primes.back() + W * Step) <= 0;
+  uint64_t BV = Small ? mpz_get_ui(Base) : 0UL;
+
+  for (std::vector<uint32_t>::const_iterator PI = Primes.begin();
+       PI != Primes.end(); ++PI) {
+    uint64_t P = *PI;
+    uint64_t S = Step % P;
+
+    if (S == 0UL)
+      continue;
+
+    uint64_t R = mpz_fdiv_ui(Base, P);
+    uint64_t K = (uint64_t) ((uint128_t) R * InvMod(S, P) % P);
+
+    if (Dir > 0 && K != 0UL)
+      K = P - K;
+
+    for (; K < W; K += P) {
+      if (Small && BV + Dir * (int64_t) (K * Step) == P)
+        continue;
+
+      Composite[K] = 1;
+    }
+  }
+}
+
+// Safe-prime variant of SieveWindow for the odd q = Base + K * Step:
+// K is marked if P divides q or 2q + 1, i.e. q = 0 or q = (P - 1) / 2
+// mod P. The window is assumed to be far above the sieving primes.
+static void SieveSafeWindow(const mpz_t& Base, uint64_t Step, size_t W,
+                            const std::vector<uint32_t>& Primes,
+                            std::vector<uint8_t>& Composite) {
+  Composite.assign(W, 0);
+
+  for (std::vector<uint32_t>::const_iterator PI = Primes.begin();
+       PI != Primes.end(); ++PI) {
+    uint64_t P = *PI;
+    uint64_t S = Step % P;
+
+    if (S == 0UL)
+      continue;
+
+    uint64_t SI = InvMod(S, P);
+    uint64_t R = mpz_fdiv_ui(Base, P);
+
+    // Base + K * S = T mod P  <=>  K = (T - Base) / S mod P.
+    uint64_t K0 = (uint64_t) ((uint128_t) (P - R) * SI % P);
+    uint64_t K1 = (uint64_t) ((uint128_t) ((P - 1UL) / 2UL + P - R) * SI % P);
+
+    for (uint64_t K = K0; K < W; K += P)
+      Composite[K] = 1;
+
+    for (uint64_t K = K1; K < W; K += P)
+      Composite[K] = 1;
+  }
+}
+
+// About ten average prime gaps worth of odd candidates.
+static inline size_t WindowWidth(size_t XB) {
+  return XB * 4UL < 256UL ? 256UL : XB * 4UL;
+}
+
+// -B if given, otherwise a sieve bound that grows with the candidates.
+static inline uint32_t WindowSieveBound(size_t XB) {
+  if (PrimeBound != static_cast<uint32_t>(~0x0))
+    return PrimeBound;
+
+  return XB * 64UL < 4096UL ? 4096U : XB * 64UL > 4194304UL ?
+    4194304U : (uint32_t) (XB * 64UL);
+}
+
+// Shared state of a next/prev prime search over one sieved window. The
+// threads claim the surviving candidates in order of distance from X;
+// the first confirmed prime stops all further claims.
+struct prime_window {
+  prime_window() : Base(), Dir(1), Step(2UL), Survivors(), Next(0UL),
+  Found(SIZE_MAX), Tested(0UL) {
+    mpz_init(Base);
+  }
+
+  ~prime_window() {
+    mpz_clear(Base);
+  }
+
+  mpz_t Base;
+  int Dir;
+  uint64_t Step;
+  std::vector<uint32_t> Survivors;
+  size_t Next;
+  size_t Found;
+  size_t Tested;
+};
+
+static prime_window Window;
+
+static inline void WindowCandidate(mpz_t& C, const prime_window& PW,
+                                   uint64_t K) {
+  if (PW.Dir > 0)
+    mpz_add_ui(C, PW.Base, K * PW.Step);
+  else
+    mpz_sub_ui(C, PW.Base, K * PW.Step);
+}
+
+extern "C" {
+  void* window_thread_start(void*) {
+    mpz_t C;
+    mpz_init2(C, Bits);
+
+    for (;;) {
+      size_t I;
+
+      pthread_mutex_lock(&mutex);
+      I = Window.Next;
+      if (I < Window.Survivors.size() && I < Window.Found)
+        ++Window.Next;
+      else
+        I = SIZE_MAX;
+      pthread_mutex_unlock(&mutex);
+
+      if (I == SIZE_MAX)
+        break;
+
+      WindowCandidate(C, Window, Window.Survivors[I]);
+      bool P = IsPrime(C);
+
+      pthread_mutex_lock(&mutex);
+      ++Window.Tested;
+      if (P && I < Window.Found)
+        Window.Found = I;
+      pthread_mutex_unlock(&mutex);
+    }
+
+    mpz_clear(C);
+    return NULL;
+  }
+}
+
+// The first prime above (ModeNext) or below (ModePrev) RangeStart. Each
+// round sieves a window of odd candidates and lets all the threads test
+// its survivors at the same time.
+static int FindNeighbourPrime(mpz_t& R) {
+  mpz_t X;
+  mpz_init2(X, Bits);
+
+  if (mpz_set_str(X, RangeStart.c_str(), 10) != 0 || mpz_sgn(X) < 0) {
+    std::cerr << "Invalid start value " << RangeStart << '.' << std::endl;
+    mpz_clear(X);
+    return -1;
+  }
+
+  if (Mode == ModeNext && mpz_cmp_ui(X, 2UL) < 0) {
+    mpz_set_ui(R, 2UL);
+    mpz_clear(X);
+    return 0;
+  }
+
+  if (Mode == ModePrev && mpz_cmp_ui(X, 3UL) <= 0) {
+    bool Three = mpz_cmp_ui(X, 3UL) == 0;
+    mpz_clear(X);
+
+    if (Three) {
+      mpz_set_ui(R, 2UL);
+      return 0;
+    }
+
+    std::cerr << "There is no prime below " << RangeStart << '.' << std::endl;
+    return -1;
+  }
+
+  size_t XB = mpz_sizeinbase(X, 2);
+  size_t W = WindowWidth(XB);
+
+  std::vector<uint32_t> Primes;
+  SievePrimes(WindowSieveBound(XB), Primes);
+
+  Window.Dir = Mode == ModeNext ? 1 : -1;
+  Window.Step = 2UL;
+
+  if (Mode == ModeNext)
+    mpz_add_ui(Window.Base, X, mpz_odd_p(X) ? 2UL : 1UL);
+  else
+    mpz_sub_ui(Window.Base, X, mpz_odd_p(X) ? 2UL : 1UL);
+
+  std::vector<uint8_t> Composite;
+  threads.resize(NThreads);
+  size_t Windows = 0UL;
+  size_t Sieved = 0UL;
+  int RC = -1;
+
+  for (;;) {
+    size_t WW = W;
+
+    // Never let a downward window run past 3.
+    if (Window.Dir < 0 && mpz_cmp_ui(Window.Base, 2UL * W + 3UL) < 0)
+      WW = (mpz_get_ui(Window.Base) - 3UL) / 2UL + 1UL;
+
+    SieveWindow(Window.Base, Window.Dir, Window.Step, WW, Primes, Composite);
+    ++Windows;
+
+    Window.Survivors.clear();
+    for (size_t K = 0UL; K < WW; ++K) {
+      if (!Composite[K])
+        Window.Survivors.push_back((uint32_t) K);
+      else
+        ++Sieved;
+    }
+
+    Window.Next = 0UL;
+    Window.Found = SIZE_MAX;
+
+    for (uint32_t i = 0; i < NThreads; ++i)
+      (void) pthread_create(&threads[i], NULL, window_thread_start, NULL);
+
+    for (uint32_t i = 0; i < NThreads; ++i)
+      (void) pthread_join(threads[i], NULL);
+
+    if (Window.Found != SIZE_MAX) {
+      WindowCandidate(R, Window, Window.Survivors[Window.Found]);
+      RC = 0;
+      break;
+    }
+
+    if (Window.Dir < 0 && WW < W) {
+      mpz_set_ui(R, 2UL);
+      RC = 0;
+      break;
+    }
+
+    if (Window.Dir > 0)
+      mpz_add_ui(Window.Base, Window.Base, W * Window.Step);
+    else
+      mpz_sub_ui(Window.Base, Window.Base, W * Window.Step);
+  }
+
+  (void) std::fprintf(stderr, "%lu window(s) of %lu candidates, %lu sieved out,"
+                      " %lu tested.\n", Windows, W, Sieved, Window.Tested);
+
+  mpz_clear(X);
+  return RC;
+}
+
+static int PrintNeighbourPrime(const char* Filename) {
+  FILE* fp = NULL;
+
+  if (Filename) {
+    errno = 0;
+    if ((fp = std::fopen(Filename, "w+")) == NULL) {
+      (void) std::fprintf(stderr, "Unable to open file '%s' for writing: %s\n",
+                          Filename, std::strerror(errno));
+      return -1;
+    }
+  } else
+    fp = stdout;
+
+  struct timespec wt_begin;
+  struct timespec wt_end;
+  (void) clock_gettime(CLOCK_MONOTONIC, &wt_begin);
+
+  mpz_t R;
+  mpz_init2(R, Bits);
+  int RC = FindNeighbourPrime(R);
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &wt_end);
+
+  if (RC == 0) {
+    char* P = mpz_get_str(NULL, 10, R);
+    (void) std::fprintf(fp, "%s\n", P);
+    mp_get_memory_functions(NULL, NULL, &gmp_free_mem_func);
+    gmp_free_mem_func(P, std::strlen(P) + 1);
+
+    if (PrintTimestamp) {
+      double WS = (double) (wt_end.tv_sec - wt_begin.tv_sec) +
+        (double) (wt_end.tv_nsec - wt_begin.tv_nsec) / 1.0e9;
+      (void) std::fprintf(fp, "-----\n");
+      (void) std::fprintf(fp, "Found the %s prime in %.6f seconds "
+                          "(wall clock).\n",
+                          Mode == ModeNext ? "next" : "previous", WS);
+    }
+  }
+
+  (void) std::fflush(fp);
+  mpz_clear(R);
+
+  if (Filename && fp != stdout)
+    (void) fclose(fp);
+
+  return RC;
+}
+
+// Shared state of the random prime generator. With a seed, every thread
+// has a fixed quota of primes and keeps them in Found[TId]; they are
+// written in thread order at the end, so the output depends only on the
+// seed and the number of threads.
+struct prime_generator {
+  prime_generator() : Primes(), Found(), Generated(0UL), Candidates(0UL),
+    fp(NULL) { }
+
+  std::vector<uint32_t> Primes;
+  std::vector<std::vector<std::string> > Found;
+  uint64_t Generated;
+  uint64_t Candidates;
+  FILE* fp;
+};
+
+static prime_generator Generator;
+
+// The Mersenne Twister is only used to replay a run from a seed (-S).
+// Its output can be predicted from the primes it produced, so without a
+// seed every random start comes from /dev/urandom instead.
+static int SeedRandomState(gmp_randstate_t& RS, uint32_t TId) {
+  mpz_t S;
+  mpz_init(S);
+
+  if (mpz_set_str(S, RandomSeed.c_str(), 10) != 0) {
+    std::cerr << "Invalid seed " << RandomSeed << '.' << std::endl;
+    mpz_clear(S);
+    return -1;
+  }
+
+  mpz_mul_2exp(S, S, 32UL);
+  mpz_add_ui(S, S, TId);
+
+  gmp_randinit_mt(RS);
+  gmp_randseed(RS, S);
+  mpz_clear(S);
+  return 0;
+}
+
+static FILE* OpenRandomDevice() {
+  errno = 0;
+  FILE* rfp = std::fopen("/dev/urandom", "r");
+
+  if (rfp == NULL) {
+    std::cerr << "Unable to open /dev/urandom: " << std::strerror(errno)
+      << std::endl;
+    return NULL;
+  }
+
+  // No copy of the random bytes is left in a stdio buffer.
+  (void) std::setvbuf(rfp, NULL, _IONBF, 0);
+  return rfp;
+}
+
+// Sets X to NB random bits read from rfp.
+static int ReadRandomBits(FILE* rfp, mpz_t X, uint32_t NB,
+                          std::vector<unsigned char>& B) {
+  B.resize((NB + 7U) / 8U);
+
+  if (std::fread(B.data(), 1, B.size(), rfp) != B.size()) {
+    std::cerr << "Unable to read /dev/urandom: " << std::strerror(errno)
+      << std::endl;
+    return -1;
+  }
+
+  mpz_import(X, B.size(), 1, 1, 0, 0, B.data());
+  mpz_tdiv_r_2exp(X, X, NB);
+  std::fill(B.begin(), B.end(), 0);
+  return 0;
+}
+
+extern "C" {
+  void* random_thread_start(void* Arg) {
+    prime_range* PR = (prime_range*) Arg;
+
+    bool Seeded = !RandomSeed.empty();
+    gmp_randstate_t RS;
+    FILE* rfp = NULL;
+
+    if (Seeded) {
+      if (SeedRandomState(RS, PR->TId) != 0)
+        return NULL;
+    } else if ((rfp = OpenRandomDevice()) == NULL)
+      return NULL;
+
+    // The first RandomCount % NThreads threads take one prime more.
+    uint64_t Quota = RandomCount / NThreads +
+      (PR->TId < RandomCount % NThreads ? 1UL : 0UL);
+    std::vector<std::string>& Found = Generator.Found[PR->TId];
+
+    // Candidates run through X + K * Step, all odd and = Residue mod
+    // Modulus. In safe-prime mode they are the q of p = 2q + 1, and
+    // safe primes are rare enough to warrant a wider window.
+    bool Safe = Mode == ModeSafe;
+    uint32_t CB = Safe ? Bits - 1U : Bits;
+    uint64_t Step = (Modulus & 1UL) ? 2UL * Modulus : Modulus;
+    size_t W = Safe ? 16UL * WindowWidth(Bits) : WindowWidth(Bits);
+
+    mpz_t X;
+    mpz_t C;
+    mpz_t SP;
+    mpz_t F;
+    mpz_t Limit;
+    mpz_init2(X, Bits + 64);
+    mpz_init2(C, Bits + 64);
+    mpz_init2(SP, Bits + 64);
+    mpz_init2(F, Bits + 64);
+    mpz_init2(Limit, Bits + 1);
+    mpz_setbit(Limit, CB);
+
+    std::vector<uint8_t> Composite;
+    std::vector<unsigned char> RB;
+    uint64_t Tested = 0UL;
+
+    for (;;) {
+      bool Done = Seeded && Found.size() >= Quota;
+      if (!Seeded) {
+        pthread_mutex_lock(&mutex);
+        Done = Generator.Generated >= RandomCount;
+        pthread_mutex_unlock(&mutex);
+      }
+
+      if (Done)
+        break;
+
+      if (Seeded)
+        mpz_urandomb(X, RS, CB);
+      else if (ReadRandomBits(rfp, X, CB, RB) != 0)
+        break;
+      if (ExactBits)
+        mpz_setbit(X, CB - 1);
+
+      uint64_t R = mpz_fdiv_ui(X, Modulus);
+      mpz_sub_ui(X, X, R);
+      mpz_add_ui(X, X, Residue);
+      if (mpz_even_p(X))
+        mpz_add_ui(X, X, Modulus);
+
+      if (Safe)
+        SieveSafeWindow(X, Step, W, Generator.Primes, Composite);
+      else
+        SieveWindow(X, 1, Step, W, Generator.Primes, Composite);
+
+      // One prime per random start, then a fresh start: taking more
+      // primes from the same window would make them correlated.
+      for (size_t K = 0UL; K < W; ++K) {
+        if (Composite[K])
+          continue;
+
+        mpz_add_ui(C, X, K * Step);
+        if (mpz_cmp(C, Limit) >= 0)
+          break;
+
+        ++Tested;
+        if (Safe) {
+          // Base-2 Fermat tests on q, then on p = 2q + 1, weed out all
+          // but a tiny fraction before the full tests of both.
+          mpz_set_ui(F, 2UL);
+          mpz_sub_ui(SP, C, 1UL);
+          mpz_powm(F, F, SP, C);
+          if (mpz_cmp_ui(F, 1UL) != 0)
+            continue;
+
+          mpz_mul_2exp(SP, C, 1UL);
+          mpz_set_ui(F, 2UL);
+          mpz_add_ui(C, SP, 1UL);
+          mpz_powm(F, F, SP, C);
+          if (mpz_cmp_ui(F, 1UL) != 0)
+            continue;
+
+          mpz_tdiv_q_2exp(SP, SP, 1UL);
+          if (!IsPrime(SP) || !IsPrime(C))
+            continue;
+        } else if (!IsPrime(C))
+          continue;
+
+        if (ExactBits && mpz_sizeinbase(C, 2) != Bits)
+          break;
+
+        if (Seeded) {
+          std::string P(mpz_sizeinbase(C, 10) + 2UL, '\0');
+          (void) mpz_get_str(&P[0], 10, C);
+          P.resize(std::strlen(P.c_str()));
+          Found.push_back(P);
+        }
+
+        pthread_mutex_lock(&mutex);
+        if (Seeded)
+          ++Generator.Generated;
+        else if (Generator.Generated < RandomCount) {
+          ++Generator.Generated;
+          (void) gmp_fprintf(Generator.fp, "%Zd\n", C);
+          (void) std::fflush(Generator.fp);
+        }
+        pthread_mutex_unlock(&mutex);
+        break;
+      }
+    }
+
+    pthread_mutex_lock(&mutex);
+    Generator.Candidates += Tested;
+    pthread_mutex_unlock(&mutex);
+
+    mpz_clear(Limit);
+    mpz_clear(F);
+    mpz_clear(SP);
+    mpz_clear(C);
+    mpz_clear(X);
+    if (Seeded)
+      gmp_randclear(RS);
+    else
+      (void) std::fclose(rfp);
+    return NULL;
+  }
+}
+
+// Streams RandomCount random primes of Bits bits, one per line.
+static int GenerateRandomPrimes(const char* Filename) {
+  if (Filename) {
+    errno = 0;
+    if ((Generator.fp = std::fopen(Filename, "w+")) == NULL) {
+      (void) std::fprintf(stderr, "Unable to open file '%s' for writing: %s\n",
+                          Filename, std::strerror(errno));
+      return -1;
+    }
+  } else
+    Generator.fp = stdout;
+
+  SievePrimes(WindowSieveBound(Bits), Generator.Primes);
+
+  struct timespec wt_begin;
+  struct timespec wt_end;
+  (void) clock_gettime(CLOCK_MONOTONIC, &wt_begin);
+
+  ranges.resize(NThreads);
+  threads.resize(NThreads);
+  Generator.Found.resize(NThreads);
+
+  for (uint32_t i = 0; i < NThreads; ++i) {
+    ranges[i].TId = i;
+    (void) pthread_create(&threads[i], NULL, random_thread_start, &ranges[i]);
+  }
+
+  for (uint32_t i = 0; i < NThreads; ++i)
+    (void) pthread_join(threads[i], NULL);
+
+  for (uint32_t i = 0; i < NThreads; ++i) {
+    for (size_t K = 0UL; K < Generator.Found[i].size(); ++K)
+      (void) std::fprintf(Generator.fp, "%s\n",
+                          Generator.Found[i][K].c_str());
+  }
+  (void) std::fflush(Generator.fp);
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &wt_end);
+
+  double WS = (double) (wt_end.tv_sec - wt_begin.tv_sec) +
+    (double) (wt_end.tv_nsec - wt_begin.tv_nsec) / 1.0e9;
+
+  (void) std::fprintf(stderr, "Generated %lu %u-bit prime(s) in %.6f seconds: "
+                      "%.3f primes/sec, %lu candidates tested.\n",
+                      Generator.Generated, Bits, WS,
+                      WS > 0.0 ? (double) Generator.Generated / WS : 0.0,
+                      Generator.Candidates);
+
+  if (Filename && Generator.fp != stdout)
+    (void) fclose(Generator.fp);
+
+  return Generator.Generated == RandomCount ? 0 : -1;
+}
+
+// k*2^n+/-1 sieve. One of k and n is fixed and the other one runs over a
+// range; for every odd sieving prime p the candidates divisible by p are
+// found in closed form:
+//
+//   fixed n: k = -/+2^-n mod p, one residue class of k.
+//   fixed k: 2^n = -/+k^-1 mod p, a discrete logarithm. Baby-step
+//            giant-step over the n range finds the smallest solution n0
+//            and the order d of 2 mod p; the hits are n0 + i * d.
+//
+// The primes are handed out in rounds, and a round has two passes. First
+// the threads share out its primes and find, for each one, the first
+// candidate it divides and the step to the next. Then every thread marks
+// all of these progressions in its own slice of the candidates, so no
+// thread needs a copy of the bitmap. With -C the survivors and the last
+// prime of the round are written to the checkpoint file after the round. A restart with the same parameters
+// resumes after that prime, also with a larger -B than before.
+
+static const size_t SieveRoundPrimes = 65536UL;
+
+// Candidates First, First + Step, ...; Step 0 is a single candidate and
+// First ~0 none at all.
+struct kn_hits {
+  uint64_t First;
+  uint64_t Step;
+};
+
+struct kn_sieve {
+  kn_sieve() : Primes(), Composite(), Hits(), Begin(0UL), End(0UL),
+    Count(0UL), Sign(1) { }
+
+  std::vector<uint32_t> Primes;
+  std::vector<uint8_t> Composite;
+  std::vector<kn_hits> Hits;
+  size_t Begin;
+  size_t End;
+  size_t Count;
+  int Sign;
+};
+
+static kn_sieve KNSieve;
+
+static inline uint64_t MulModSmall(uint64_t A, uint64_t B, uint64_t P) {
+  return A * B % P;
+}
+
+static uint64_t PowModSmall(uint64_t B, uint64_t E, uint64_t P) {
+  uint64_t R = 1UL % P;
+
+  B %= P;
+  while (E) {
+    if (E & 1UL)
+      R = MulModSmall(R, B, P);
+
+    B = MulModSmall(B, B, P);
+    E >>= 1;
+  }
+
+  return R;
+}
+
+// Open addressing table of the baby steps 2^j -> smallest j.
+struct bsgs_table {
+  bsgs_table() : Keys(), Values(), Mask(0UL) { }
+
+  void Reset(size_t N) {
+    size_t S = 16UL;
+    while (S < 2UL * N)
+      S <<= 1;
+
+    Keys.assign(S, 0U);
+    Values.resize(S);
+    Mask = S - 1UL;
+  }
+
+  // Keys are stored + 1, so that 0 marks an empty slot.
+  inline void Insert(uint32_t K, uint32_t V) {
+    size_t H = ((uint64_t) K * 0x9e3779b97f4a7c15UL) >> 32 & Mask;
+
+    while (Keys[H]) {
+      if (Keys[H] == K + 1U)
+        return;
+
+      H = (H + 1UL) & Mask;
+    }
+
+    Keys[H] = K + 1U;
+    Values[H] = V;
+  }
+
+  inline bool Find(uint32_t K, uint32_t& V) const {
+    size_t H = ((uint64_t) K * 0x9e3779b97f4a7c15UL) >> 32 & Mask;
+
+    while (Keys[H]) {
+      if (Keys[H] == K + 1U) {
+        V = Values[H];
+        return true;
+      }
+
+      H = (H + 1UL) & Mask;
+    }
+
+    return false;
+  }
+
+  std::vector<uint32_t> Keys;
+  std::vector<uint32_t> Values;
+  size_t Mask;
+};
+
+// k * 2^n + Sign, if it is below 2^63.
+static bool KNValue(uint64_t K, uint64_t N, int Sign, uint64_t& V) {
+  if (N >= 63UL || K >= (1UL << (63UL - N)))
+    return false;
+
+  V = (K << N) + (uint64_t) (int64_t) Sign;
+  return true;
+}
+
+// The candidates divisible by P; candidate I is n = NMin + I.
+static kn_hits SolveFixedK(uint64_t P, bsgs_table& BT) {
+  kn_hits H = { ~0UL, 0UL };
+  uint64_t K = KMin % P;
+  if (K == 0UL)
+    return H;
+
+  // 2^n = T mod P.
+  uint64_t T = InvMod(K, P);
+  if (KNSieve.Sign > 0)
+    T = P - T;
+
+  uint64_t R = NMax - NMin + 1UL;
+  uint64_t M = (uint64_t) std::sqrt((double) R) + 1UL;
+  uint64_t Order = 0UL;
+
+  BT.Reset(M);
+
+  uint64_t X = 1UL;
+  for (uint64_t J = 0UL; J < M; ++J) {
+    if (J && X == 1UL) {
+      Order = J;
+      break;
+    }
+
+    BT.Insert((uint32_t) X, (uint32_t) J);
+    X = MulModSmall(X, 2UL, P);
+  }
+
+  // Y = T * 2^-NMin; n = NMin + I * M + J solves 2^(I * M + J) = Y.
+  uint64_t Inv2 = (P + 1UL) / 2UL;
+  uint64_t Y = MulModSmall(T, PowModSmall(Inv2, NMin, P), P);
+  uint64_t N0 = ~0UL;
+  uint32_t J;
+
+  if (Order) {
+    if (BT.Find((uint32_t) Y, J))
+      N0 = NMin + J;
+  } else {
+    uint64_t G = PowModSmall(Inv2, M, P);
+
+    for (uint64_t I = 0UL; I * M < R; ++I) {
+      if (BT.Find((uint32_t) Y, J)) {
+        N0 = NMin + I * M + J;
+        break;
+      }
+
+      Y = MulModSmall(Y, G, P);
+    }
+
+    // The order is the smallest d > 0 with 2^d = 1; it is only needed
+    // if the next hit could still be inside the range.
+    if (N0 <= NMax) {
+      Y = G;
+      for (uint64_t I = 1UL; I * M <= NMax - N0; ++I) {
+        if (BT.Find((uint32_t) Y, J)) {
+          Order = I * M + J;
+          break;
+        }
+
+        Y = MulModSmall(Y, G, P);
+      }
+    }
+  }
+
+  if (N0 > NMax)
+    return H;
+
+  H.First = N0 - NMin;
+  H.Step = Order;
+  return H;
+}
+
+// The candidates divisible by P; candidate I is k = KMin + I.
+static kn_hits SolveFixedN(uint64_t P) {
+  // k = -/+2^-n mod P.
+  uint64_t K0 = PowModSmall((P + 1UL) / 2UL, NMin, P);
+  if (KNSieve.Sign > 0)
+    K0 = (P - K0) % P;
+
+  kn_hits H = { (K0 + P - KMin % P) % P, P };
+  return H;
+}
+
+// Marks the candidates of H in [Lo, Hi), except P itself.
+static void MarkHits(const kn_hits& H, uint64_t P, uint64_t Lo, uint64_t Hi) {
+  uint64_t I = H.First;
+  if (I >= Hi)
+    return;
+
+  if (I < Lo) {
+    if (H.Step == 0UL)
+      return;
+
+    I += (Lo - I + H.Step - 1UL) / H.Step * H.Step;
+  }
+
+  for ( ; I < Hi; I += H.Step) {
+    uint64_t V;
+    bool Valid = KMin == KMax ? KNValue(KMin, NMin + I, KNSieve.Sign, V) :
+      KNValue(KMin + I, NMin, KNSieve.Sign, V);
+
+    if (!Valid || V != P)
+      KNSieve.Composite[I] = 1U;
+
+    if (H.Step == 0UL)
+      break;
+  }
+}
+
+extern "C" {
+  void* kn_solve_thread_start(void* Arg) {
+    prime_range* PR = (prime_range*) Arg;
+    bsgs_table BT;
+
+    for (size_t I = KNSieve.Begin + PR->TId; I < KNSieve.End; I += NThreads) {
+      uint64_t P = KNSieve.Primes[I];
+      kn_hits& H = KNSieve.Hits[I - KNSieve.Begin];
+
+      if (P == 2UL) {
+        H.First = ~0UL;
+        H.Step = 0UL;
+      } else if (KMin == KMax)
+        H = SolveFixedK(P, BT);
+      else
+        H = SolveFixedN(P);
+    }
+
+    return NULL;
+  }
+
+  void* kn_sieve_thread_start(void* Arg) {
+    prime_range* PR = (prime_range*) Arg;
+
+    // Slices of whole cache lines.
+    uint64_t S = ((KNSieve.Count + NThreads - 1UL) / NThreads + 63UL) & ~63UL;
+    uint64_t Lo = std::min<uint64_t>(S * PR->TId, KNSieve.Count);
+    uint64_t Hi = std::min<uint64_t>(Lo + S, KNSieve.Count);
+
+    for (size_t I = KNSieve.Begin; Lo < Hi && I < KNSieve.End; ++I)
+      MarkHits(KNSieve.Hits[I - KNSieve.Begin], KNSieve.Primes[I], Lo, Hi);
+
+    return NULL;
+  }
+}
+
+struct kn_checkpoint {
+  char Magic[8];
+  int64_t Sign;
+  uint64_t KMin;
+  uint64_t KMax;
+  uint64_t NMin;
+  uint64_t NMax;
+  uint64_t LastPrime;
+};
+
+static const char KNMagic[8] = { 'K', 'N', 'S', 'I', 'E', 'V', 'E', '1' };
+
+static void KNHeader(kn_checkpoint& H, uint64_t LastPrime) {
+  std::memcpy(H.Magic, KNMagic, sizeof(KNMagic));
+  H.Sign = KNSieve.Sign;
+  H.KMin = KMin;
+  H.KMax = KMax;
+  H.NMin = NMin;
+  H.NMax = NMax;
+  H.LastPrime = LastPrime;
+}
+
+// Returns the last prime already sieved, 0 if there is no usable
+// checkpoint.
+static uint64_t ReadCheckpoint() {
+  FILE* cfp = std::fopen(CheckpointFile, "r");
+  if (cfp == NULL)
+    return 0UL;
+
+  kn_checkpoint H;
+  kn_checkpoint E;
+  uint64_t LP = 0UL;
+
+  if (std::fread(&H, sizeof(H), 1, cfp) == 1) {
+    KNHeader(E, H.LastPrime);
+
+    if (std::memcmp(&H, &E, sizeof(H)) == 0 &&
+        std::fread(KNSieve.Composite.data(), 1, KNSieve.Count, cfp) ==
+        KNSieve.Count)
+      LP = H.LastPrime;
+    else
+      std::cerr << "Ignoring checkpoint '" << CheckpointFile
+        << "': different parameters." << std::endl;
+  }
+
+  (void) std::fclose(cfp);
+
+  if (LP == 0UL)
+    std::fill(KNSieve.Composite.begin(), KNSieve.Composite.end(), 0U);
+
+  return LP;
+}
+
+// Written to a temporary file and renamed, so that an interrupted write
+// leaves the previous checkpoint intact.
+static int WriteCheckpoint(uint64_t LastPrime) {
+  std::string TF = std::string(CheckpointFile) + ".tmp";
+  FILE* cfp = std::fopen(TF.c_str(), "w");
+
+  if (cfp == NULL) {
+    (void) std::fprintf(stderr, "Unable to open file '%s' for writing: %s\n",
+                        TF.c_str(), std::strerror(errno));
+    return -1;
+  }
+
+  kn_checkpoint H;
+  KNHeader(H, LastPrime);
+
+  bool OK = std::fwrite(&H, sizeof(H), 1, cfp) == 1 &&
+    std::fwrite(KNSieve.Composite.data(), 1, KNSieve.Count, cfp) ==
+    KNSieve.Count;
+
+  OK = std::fclose(cfp) == 0 && OK;
+
+  if (!OK || std::rename(TF.c_str(), CheckpointFile) != 0) {
+    (void) std::fprintf(stderr, "Unable to write checkpoint '%s': %s\n",
+                        CheckpointFile, std::strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+// Sieves k*2^n+/-1 and writes the survivors as "k n" lines.
+static int SieveKN(const char* Filename) {
+  KNSieve.Sign = Mode == ModeProth ? 1 : -1;
+  KNSieve.Count = KMin == KMax ? NMax - NMin + 1UL : KMax - KMin + 1UL;
+  KNSieve.Composite.assign(KNSieve.Count, 0U);
+
+  uint32_t SB = PrimeBound == static_cast<uint32_t>(~0x0) ?
+    1048576U : PrimeBound;
+  SievePrimes(SB, KNSieve.Primes);
+
+  uint64_t LP = CheckpointFile ? ReadCheckpoint() : 0UL;
+  size_t PI = 0UL;
+  while (PI < KNSieve.Primes.size() && KNSieve.Primes[PI] <= LP)
+    ++PI;
+
+  if (LP)
+    std::cerr << "Resuming after p = " << LP << '.' << std::endl;
+
+  struct timespec wt_begin;
+  struct timespec wt_end;
+  (void) clock_gettime(CLOCK_MONOTONIC, &wt_begin);
+
+  ranges.resize(NThreads);
+  threads.resize(NThreads);
+
+  KNSieve.Hits.resize(SieveRoundPrimes);
+
+  while (PI < KNSieve.Primes.size()) {
+    KNSieve.Begin = PI;
+    KNSieve.End = std::min(PI + SieveRoundPrimes, KNSieve.Primes.size());
+
+    for (uint32_t i = 0; i < NThreads; ++i) {
+      ranges[i].TId = i;
+      (void) pthread_create(&threads[i], NULL, kn_solve_thread_start,
+                            &ranges[i]);
+    }
+
+    for (uint32_t i = 0; i < NThreads; ++i)
+      (void) pthread_join(threads[i], NULL);
+
+    for (uint32_t i = 0; i < NThreads; ++i)
+      (void) pthread_create(&threads[i], NULL, kn_sieve_thread_start,
+                            &ranges[i]);
+
+    for (uint32_t i = 0; i < NThreads; ++i)
+      (void) pthread_join(threads[i], NULL);
+
+    PI = KNSieve.End;
+    LP = KNSieve.Primes[PI - 1UL];
+
+    if (CheckpointFile && WriteCheckpoint(LP) != 0)
+      return -1;
+  }
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &wt_end);
+
+  FILE* fp = stdout;
+  if (Filename) {
+    errno = 0;
+    if ((fp = std::fopen(Filename, "w+")) == NULL) {
+      (void) std::fprintf(stderr, "Unable to open file '%s' for writing: %s\n",
+                          Filename, std::strerror(errno));
+      return -1;
+    }
+  }
+
+  if (PrintHeader)
+    (void) std::fprintf(fp, "# k*2^n%c1, k = [%lu, %lu], n = [%lu, %lu], "
+                        "sieved to p = %lu\n", KNSieve.Sign > 0 ? '+' : '-',
+                        KMin, KMax, NMin, NMax, LP);
+
+  size_t Survivors = 0UL;
+  for (size_t I = 0UL; I < KNSieve.Count; ++I) {
+    if (KNSieve.Composite[I])
+      continue;
+
+    ++Survivors;
+    if (KMin == KMax)
+      (void) std::fprintf(fp, "%lu %lu\n", KMin, NMin + I);
+    else
+      (void) std::fprintf(fp, "%lu %lu\n", KMin + I, NMin);
+  }
+
+  if (Filename)
+    (void) std::fclose(fp);
+
+  double WS = (double) (wt_end.tv_sec - wt_begin.tv_sec) +
+    (double) (wt_end.tv_nsec - wt_begin.tv_nsec) / 1.0e9;
+
+  (void) std::fprintf(stderr, "Sieved %lu candidates to p = %lu in %.6f "
+                      "seconds: %lu survivors.\n", KNSieve.Count, LP, WS,
+                      Survivors);
+  return 0;
+}
+
+// "A" or "A:B".
+static bool ParseRange(const char* S, uint64_t& A, uint64_t& B) {
+  char* E;
+
+  errno = 0;
+  A = (uint64_t) std::strtoull(S, &E, 10);
+  B = A;
+
+  if (*E == ':')
+    B = (uint64_t) std::strtoull(E + 1, &E, 10);
+
+  return errno == 0 && *E == '\0' && E != S && A <= B;
 }
 
 int main(int argc, char* argv[])
@@ -510,7 +1657,7 @@ int main(int argc, char* argv[])
     return 1;
   }
 
-  while ((opt = getopt(argc, argv, "hpts:e:b:f:T:")) != -1) {
+  while ((opt = getopt(argc, argv, "hptxs:e:b:f:T:B:m:c:S:r:k:n:C:")) != -1) {
     switch (opt) {
     case 'h':
       ph = true;
@@ -536,6 +1683,51 @@ int main(int argc, char* argv[])
     case 'T':
       NThreads = (uint32_t) std::strtoul(optarg, NULL, 10);
       break;
+    case 'B':
+      PrimeBound = (uint32_t) std::strtoul(optarg, NULL, 10);
+      break;
+    case 'm':
+      if (std::strcmp(optarg, "next") == 0)
+        Mode = ModeNext;
+      else if (std::strcmp(optarg, "prev") == 0)
+        Mode = ModePrev;
+      else if (std::strcmp(optarg, "random") == 0)
+        Mode = ModeRandom;
+      else if (std::strcmp(optarg, "safe") == 0)
+        Mode = ModeSafe;
+      else if (std::strcmp(optarg, "proth") == 0)
+        Mode = ModeProth;
+      else if (std::strcmp(optarg, "riesel") == 0)
+        Mode = ModeRiesel;
+      else if (std::strcmp(optarg, "range") == 0)
+        Mode = ModeRange;
+      else
+        ph = true;
+      break;
+    case 'c':
+      RandomCount = (uint64_t) std::strtoull(optarg, NULL, 10);
+      break;
+    case 'S':
+      RandomSeed = optarg;
+      break;
+    case 'x':
+      ExactBits = true;
+      break;
+    case 'r':
+      if (std::sscanf(optarg, "%lu:%lu", &Residue, &Modulus) != 2)
+        ph = true;
+      break;
+    case 'k':
+      if (!ParseRange(optarg, KMin, KMax))
+        ph = true;
+      break;
+    case 'n':
+      if (!ParseRange(optarg, NMin, NMax))
+        ph = true;
+      break;
+    case 'C':
+      CheckpointFile = optarg;
+      break;
     default:
       ph = true;
       break;
@@ -555,6 +1747,56 @@ int main(int argc, char* argv[])
   if (RangeStart.empty())
     RangeStart = "18446744073709551615";
 
+  if (Mode == ModeNext || Mode == ModePrev)
+    return PrintNeighbourPrime(Filename) == 0 ? 0 : 1;
+
+  if (Mode == ModeProth || Mode == ModeRiesel) {
+    if (KMin == 0UL || NMin == 0UL || (KMin != KMax && NMin != NMax)) {
+      std::cerr << "Sieving needs k, n > 0 and at most one of them as a range."
+        << std::endl;
+      return 1;
+    }
+
+    if (KMax - KMin >= 0xffffffffUL || NMax - NMin >= 0xffffffffUL) {
+      std::cerr << "The sieve range must be shorter than 2^32." << std::endl;
+      return 1;
+    }
+
+    return SieveKN(Filename) == 0 ? 0 : 1;
+  }
+
+  if (Mode == ModeRandom || Mode == ModeSafe) {
+    if (CheckBits(Bits) != 0)
+      return 1;
+
+    if (Mode == ModeSafe && (Residue != 0UL || Modulus != 1UL)) {
+      std::cerr << "-r cannot be combined with -m safe." << std::endl;
+      return 1;
+    }
+
+    if (Modulus == 0UL || Modulus > (1UL << 40) || Residue >= Modulus) {
+      std::cerr << "The congruence must satisfy 0 <= a < m <= 2^40."
+        << std::endl;
+      return 1;
+    }
+
+    uint64_t A = Residue;
+    uint64_t M = Modulus;
+    while (M) {
+      uint64_t T = A % M;
+      A = M;
+      M = T;
+    }
+
+    if (A != 1UL || (!(Modulus & 1UL) && !(Residue & 1UL))) {
+      std::cerr << "There are no odd primes = " << Residue << " mod "
+        << Modulus << '.' << std::endl;
+      return 1;
+    }
+
+    return GenerateRandomPrimes(Filename) == 0 ? 0 : 1;
+  }
+
   if (RangeEnd.empty()) {
     std::cerr << "A range upper bound must be specified." << std::endl;
     return 1;
@@ -0,0 +1,558 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#ifndef FIXEDMP_H
+#define FIXEDMP_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <gmp.h>
+
+// Compile-time sized unsigned integers for the 128 - 512 bit fast paths
+// of findprimesmp, isprimemp and primefactorsmp. GMP pays for dynamic
+// sizing, function calls and allocation on every operation; for a fixed
+// and small number of limbs everything here is inlined and lives on the
+// stack. Anything wider than 512 bits goes to GMP.
+
+static_assert(GMP_NUMB_BITS == 64, "fixedmp.h requires 64-bit GMP limbs.");
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// From this width on, the products and the reduction use GMP's mpn
+// kernels on the stack-resident limbs. They are hand-written assembly
+// tuned for the CPU at hand, and beat inlined C++ once the operands
+// no longer fit in a handful of registers.
+static const unsigned FixedMPNLimbs = 8U;
+
+// Limbs are stored least significant first, like GMP.
+template<unsigned Limbs>
+struct FixedMP {
+  uint64_t L[Limbs];
+};
+
+template<unsigned Limbs>
+static inline void FixedSet(FixedMP<Limbs>& R, const mpz_t& X) {
+  size_t XS = mpz_size(X);
+  std::memcpy(R.L, mpz_limbs_read(X), XS * sizeof(uint64_t));
+  std::memset(R.L + XS, 0, (Limbs - XS) * sizeof(uint64_t));
+}
+
+template<unsigned Limbs>
+static inline void FixedSetUI(FixedMP<Limbs>& R, uint64_t X) {
+  R.L[0] = X;
+  for (unsigned I = 1U; I < Limbs; ++I)
+    R.L[I] = 0UL;
+}
+
+template<unsigned Limbs>
+static inline void FixedGet(mpz_t& R, const FixedMP<Limbs>& X) {
+  mp_limb_t* D = mpz_limbs_write(R, Limbs);
+  std::memcpy(D, X.L, Limbs * sizeof(uint64_t));
+
+  mp_size_t S = Limbs;
+  while (S > 0 && X.L[S - 1] == 0UL)
+    --S;
+
+  mpz_limbs_finish(R, S);
+}
+
+template<unsigned Limbs>
+static inline int FixedCmp(const FixedMP<Limbs>& A, const FixedMP<Limbs>& B) {
+  for (unsigned I = Limbs; I-- > 0U; ) {
+    if (A.L[I] != B.L[I])
+      return A.L[I] < B.L[I] ? -1 : 1;
+  }
+
+  return 0;
+}
+
+template<unsigned Limbs>
+static inline bool FixedIsZero(const FixedMP<Limbs>& A) {
+  uint64_t V = 0UL;
+  for (unsigned I = 0U; I < Limbs; ++I)
+    V |= A.L[I];
+
+  return V == 0UL;
+}
+
+// R = A + B, returns the carry out.
+template<unsigned Limbs>
+static inline uint64_t FixedAdd(FixedMP<Limbs>& R, const FixedMP<Limbs>& A,
+                                const FixedMP<Limbs>& B) {
+  uint64_t C = 0UL;
+
+  for (unsigned I = 0U; I < Limbs; ++I) {
+    uint128_t S = (uint128_t) A.L[I] + B.L[I] + C;
+    R.L[I] = (uint64_t) S;
+    C = (uint64_t) (S >> 64);
+  }
+
+  return C;
+}
+
+// R = A - B, returns the borrow out.
+template<unsigned Limbs>
+static inline uint64_t FixedSub(FixedMP<Limbs>& R, const FixedMP<Limbs>& A,
+                                const FixedMP<Limbs>& B) {
+  uint64_t W = 0UL;
+
+  for (unsigned I = 0U; I < Limbs; ++I) {
+    uint128_t D = (uint128_t) A.L[I] - B.L[I] - W;
+    R.L[I] = (uint64_t) D;
+    W = (uint64_t) (D >> 64) & 1UL;
+  }
+
+  return W;
+}
+
+// Full schoolbook product, R has 2 * Limbs limbs.
+template<unsigned Limbs>
+static inline void FixedMul(uint64_t (&R)[2 * Limbs], const FixedMP<Limbs>& A,
+                            const FixedMP<Limbs>& B) {
+  for (unsigned I = 0U; I < 2 * Limbs; ++I)
+    R[I] = 0UL;
+
+  for (unsigned I = 0U; I < Limbs; ++I) {
+    uint64_t C = 0UL;
+
+    for (unsigned J = 0U; J < Limbs; ++J) {
+      uint128_t T = (uint128_t) A.L[J] * B.L[I] + R[I + J] + C;
+      R[I + J] = (uint64_t) T;
+      C = (uint64_t) (T >> 64);
+    }
+
+    R[I + Limbs] = C;
+  }
+}
+
+// Full square, R has 2 * Limbs limbs. The cross products are formed
+// once and doubled, which saves almost half of the multiplications.
+template<unsigned Limbs>
+static inline void FixedSqr(uint64_t (&R)[2 * Limbs], const FixedMP<Limbs>& A) {
+  for (unsigned I = 0U; I < 2 * Limbs; ++I)
+    R[I] = 0UL;
+
+  for (unsigned I = 0U; I < Limbs; ++I) {
+    uint64_t C = 0UL;
+
+    for (unsigned J = I + 1U; J < Limbs; ++J) {
+      uint128_t T = (uint128_t) A.L[J] * A.L[I] + R[I + J] + C;
+      R[I + J] = (uint64_t) T;
+      C = (uint64_t) (T >> 64);
+    }
+
+    R[I + Limbs] = C;
+  }
+
+  uint64_t H = 0UL;
+  for (unsigned I = 0U; I < 2 * Limbs; ++I) {
+    uint64_t V = R[I];
+    R[I] = (V << 1) | H;
+    H = V >> 63;
+  }
+
+  uint64_t C = 0UL;
+  for (unsigned I = 0U; I < Limbs; ++I) {
+    uint128_t T = (uint128_t) A.L[I] * A.L[I];
+    uint128_t S = (uint128_t) R[2 * I] + (uint64_t) T + C;
+    R[2 * I] = (uint64_t) S;
+    S = (uint128_t) R[2 * I + 1] + (uint64_t) (T >> 64) + (uint64_t) (S >> 64);
+    R[2 * I + 1] = (uint64_t) S;
+    C = (uint64_t) (S >> 64);
+  }
+}
+
+template<unsigned Limbs>
+static inline void FixedShiftRight(FixedMP<Limbs>& A, unsigned S) {
+  unsigned W = S / 64U;
+  unsigned B = S % 64U;
+
+  for (unsigned I = 0U; I < Limbs; ++I) {
+    uint64_t Lo = (I + W < Limbs) ? A.L[I + W] : 0UL;
+    uint64_t Hi = (I + W + 1U < Limbs) ? A.L[I + W + 1U] : 0UL;
+    A.L[I] = B ? ((Lo >> B) | (Hi << (64U - B))) : Lo;
+  }
+}
+
+template<unsigned Limbs>
+static inline unsigned FixedCtz(const FixedMP<Limbs>& A) {
+  for (unsigned I = 0U; I < Limbs; ++I) {
+    if (A.L[I])
+      return I * 64U + (unsigned) __builtin_ctzll(A.L[I]);
+  }
+
+  return Limbs * 64U;
+}
+
+template<unsigned Limbs>
+static inline unsigned FixedBits(const FixedMP<Limbs>& A) {
+  for (unsigned I = Limbs; I-- > 0U; ) {
+    if (A.L[I])
+      return I * 64U + 64U - (unsigned) __builtin_clzll(A.L[I]);
+  }
+
+  return 0U;
+}
+
+template<unsigned Limbs>
+static inline bool FixedTestBit(const FixedMP<Limbs>& A, unsigned B) {
+  return (A.L[B / 64U] >> (B % 64U)) & 1UL;
+}
+
+// Montgomery arithmetic modulo an odd N, R = 2^(64 * Limbs).
+template<unsigned Limbs>
+struct FixedMontgomery {
+  FixedMontgomery() : N(), One(), R2(), NInv(0UL) { }
+
+  void Init(const mpz_t& M) {
+    FixedSet(N, M);
+
+    // Newton iteration for N^-1 mod 2^64, each step doubles the
+    // number of correct bits.
+    uint64_t Inv = N.L[0];
+    for (unsigned I = 0U; I < 6U; ++I)
+      Inv *= 2UL - N.L[0] * Inv;
+
+    NInv = -Inv;
+
+    mpz_t T;
+    mpz_init2(T, 2 * Limbs * 64 + 1);
+
+    mpz_set_ui(T, 0UL);
+    mpz_setbit(T, Limbs * 64);
+    mpz_mod(T, T, M);
+    FixedSet(One, T);
+
+    mpz_set_ui(T, 0UL);
+    mpz_setbit(T, 2 * Limbs * 64);
+    mpz_mod(T, T, M);
+    FixedSet(R2, T);
+
+    mpz_clear(T);
+  }
+
+  // R = A * B * R^-1 mod N. The full product is formed first, so its
+  // partial products are independent of each other, then it is reduced
+  // one limb at a time (separated operand scanning). R may alias A or B.
+  inline void Mul(FixedMP<Limbs>& R, const FixedMP<Limbs>& A,
+                  const FixedMP<Limbs>& B) const {
+    uint64_t T[2 * Limbs];
+
+    if (Limbs >= FixedMPNLimbs)
+      mpn_mul_n(T, A.L, B.L, Limbs);
+    else
+      FixedMul(T, A, B);
+
+    Reduce(R, T);
+  }
+
+  inline void Sqr(FixedMP<Limbs>& R, const FixedMP<Limbs>& A) const {
+    uint64_t T[2 * Limbs];
+
+    if (Limbs >= FixedMPNLimbs)
+      mpn_sqr(T, A.L, Limbs);
+    else
+      FixedSqr(T, A);
+
+    Reduce(R, T);
+  }
+
+  // R = T * R^-1 mod N, for T < N * 2^(64 * Limbs).
+  inline void Reduce(FixedMP<Limbs>& R, uint64_t (&T)[2 * Limbs]) const {
+    uint64_t H = 0UL;
+
+    for (unsigned I = 0U; I < Limbs; ++I) {
+      uint64_t M = T[I] * NInv;
+      uint64_t C = 0UL;
+
+      if (Limbs >= FixedMPNLimbs) {
+        C = mpn_addmul_1(T + I, N.L, Limbs, M);
+      } else {
+        for (unsigned J = 0U; J < Limbs; ++J) {
+          uint128_t P = (uint128_t) M * N.L[J] + T[I + J] + C;
+          T[I + J] = (uint64_t) P;
+          C = (uint64_t) (P >> 64);
+        }
+      }
+
+      uint128_t S = (uint128_t) T[I + Limbs] + C + H;
+      T[I + Limbs] = (uint64_t) S;
+      H = (uint64_t) (S >> 64);
+    }
+
+    for (unsigned I = 0U; I < Limbs; ++I)
+      R.L[I] = T[I + Limbs];
+
+    if (H || FixedCmp(R, N) >= 0)
+      (void) FixedSub(R, R, N);
+  }
+
+  inline void ToMont(FixedMP<Limbs>& R, const FixedMP<Limbs>& A) const {
+    Mul(R, A, R2);
+  }
+
+  inline void FromMont(FixedMP<Limbs>& R, const FixedMP<Limbs>& A) const {
+    FixedMP<Limbs> U;
+    FixedSetUI(U, 1UL);
+    Mul(R, A, U);
+  }
+
+  inline void AddMod(FixedMP<Limbs>& R, const FixedMP<Limbs>& A,
+                     const FixedMP<Limbs>& B) const {
+    uint64_t C = FixedAdd(R, A, B);
+    if (C || FixedCmp(R, N) >= 0)
+      (void) FixedSub(R, R, N);
+  }
+
+  inline void SubMod(FixedMP<Limbs>& R, const FixedMP<Limbs>& A,
+                     const FixedMP<Limbs>& B) const {
+    if (FixedSub(R, A, B))
+      (void) FixedAdd(R, R, N);
+  }
+
+  // R = B^E, B and R in Montgomery form, E in normal form. Fixed 4-bit
+  // window: one multiplication per four squarings.
+  inline void Pow(FixedMP<Limbs>& R, const FixedMP<Limbs>& B,
+                  const FixedMP<Limbs>& E) const {
+    FixedMP<Limbs> W[16];
+    W[0] = One;
+    W[1] = B;
+    for (unsigned I = 2U; I < 16U; ++I)
+      Mul(W[I], W[I - 1], B);
+
+    FixedMP<Limbs> X = One;
+    unsigned EB = (FixedBits(E) + 3U) & ~3U;
+
+    for (unsigned I = EB; I > 0U; I -= 4U) {
+      if (I != EB) {
+        Sqr(X, X);
+        Sqr(X, X);
+        Sqr(X, X);
+        Sqr(X, X);
+      }
+
+      unsigned D = (unsigned) ((E.L[(I - 4U) / 64U] >> ((I - 4U) % 64U)) & 0xFUL);
+      if (D)
+        Mul(X, X, W[D]);
+    }
+
+    R = X;
+  }
+
+  FixedMP<Limbs> N;
+  FixedMP<Limbs> One;
+  FixedMP<Limbs> R2;
+  uint64_t NInv;
+};
+
+// Primes below 100; used to settle small inputs and to trial-divide
+// before the expensive part of the test.
+static const uint32_t FixedSmallPrimes[] = {
+  2U, 3U, 5U, 7U, 11U, 13U, 17U, 19U, 23U, 29U, 31U, 37U,
+  41U, 43U, 47U, 53U, 59U, 61U, 67U, 71U, 73U, 79U, 83U, 89U, 97U
+};
+
+static const unsigned FixedSmallPrimesCount =
+  sizeof(FixedSmallPrimes) / sizeof(FixedSmallPrimes[0]);
+
+// X = X / 2 mod N, X < N. Works in and out of Montgomery form.
+template<unsigned Limbs>
+static inline void FixedHalveMod(FixedMP<Limbs>& X, const FixedMP<Limbs>& N) {
+  uint64_t C = 0UL;
+
+  if (X.L[0] & 1UL)
+    C = FixedAdd(X, X, N);
+
+  FixedShiftRight(X, 1U);
+  X.L[Limbs - 1] |= C << 63;
+}
+
+// Strong Fermat (Miller-Rabin) test to base 2.
+template<unsigned Limbs>
+static bool FixedIsSPRP2(const FixedMontgomery<Limbs>& M) {
+  FixedMP<Limbs> D;
+  FixedMP<Limbs> U;
+  FixedSetUI(U, 1UL);
+  (void) FixedSub(D, M.N, U);
+
+  unsigned S = FixedCtz(D);
+  FixedShiftRight(D, S);
+
+  FixedMP<Limbs> MinusOne;
+  (void) FixedSub(MinusOne, M.N, M.One);
+
+  FixedMP<Limbs> B;
+  M.AddMod(B, M.One, M.One);
+  M.Pow(B, B, D);
+
+  if (FixedCmp(B, M.One) == 0 || FixedCmp(B, MinusOne) == 0)
+    return true;
+
+  for (unsigned J = 1U; J < S; ++J) {
+    M.Sqr(B, B);
+
+    if (FixedCmp(B, MinusOne) == 0)
+      return true;
+
+    if (FixedCmp(B, M.One) == 0)
+      return false;
+  }
+
+  return false;
+}
+
+// Strong Lucas probable-prime test with Selfridge's parameters: D is the
+// first of 5, -7, 9, -11, ... with (D/N) = -1, P = 1 and Q = (1 - D) / 4.
+template<unsigned Limbs>
+static bool FixedIsStrongLucasPRP(const mpz_t& X,
+                                  const FixedMontgomery<Limbs>& M) {
+  long D = 5L;
+
+  for (unsigned I = 0U; ; ++I) {
+    int J = mpz_si_kronecker(D, X);
+
+    if (J == -1)
+      break;
+
+    if (J == 0 && mpz_cmpabs_ui(X, (unsigned long) std::labs(D)) != 0)
+      return false;
+
+    // A perfect square never yields (D/N) = -1.
+    if (I == 10U && mpz_perfect_square_p(X))
+      return false;
+
+    D = D > 0L ? -(D + 2L) : -(D - 2L);
+  }
+
+  long Q = (1L - D) / 4L;
+
+  FixedMP<Limbs> MD;
+  FixedMP<Limbs> MQ;
+  FixedSetUI(MD, (uint64_t) std::labs(D));
+  FixedSetUI(MQ, (uint64_t) std::labs(Q));
+  M.ToMont(MD, MD);
+  M.ToMont(MQ, MQ);
+
+  FixedMP<Limbs> Zero;
+  FixedSetUI(Zero, 0UL);
+
+  if (D < 0L)
+    M.SubMod(MD, Zero, MD);
+
+  if (Q < 0L)
+    M.SubMod(MQ, Zero, MQ);
+
+  // N + 1 = K * 2^S, K odd. N + 1 only carries out of the limbs for
+  // N = 2^(64 * Limbs) - 1, which is divisible by 3 and not a prime.
+  FixedMP<Limbs> K;
+  FixedMP<Limbs> U;
+  FixedSetUI(U, 1UL);
+  if (FixedAdd(K, M.N, U))
+    return false;
+
+  unsigned S = FixedCtz(K);
+  FixedShiftRight(K, S);
+
+  FixedMP<Limbs> V = M.One;
+  FixedMP<Limbs> QK = MQ;
+  FixedMP<Limbs> T;
+  U = M.One;
+
+  for (unsigned B = FixedBits(K) - 1U; B-- > 0U; ) {
+    M.Mul(U, U, V);
+    M.Sqr(V, V);
+    M.SubMod(V, V, QK);
+    M.SubMod(V, V, QK);
+    M.Sqr(QK, QK);
+
+    if (FixedTestBit(K, B)) {
+      M.Mul(T, MD, U);
+      M.AddMod(U, U, V);
+      FixedHalveMod(U, M.N);
+      M.AddMod(V, V, T);
+      FixedHalveMod(V, M.N);
+      M.Mul(QK, QK, MQ);
+    }
+  }
+
+  if (FixedIsZero(U) || FixedIsZero(V))
+    return true;
+
+  for (unsigned R = 1U; R < S; ++R) {
+    M.Sqr(V, V);
+    M.SubMod(V, V, QK);
+    M.SubMod(V, V, QK);
+
+    if (FixedIsZero(V))
+      return true;
+
+    M.Sqr(QK, QK);
+  }
+
+  return false;
+}
+
+// Baillie-PSW for an odd N > 97 that fits in Limbs limbs: a strong
+// base-2 test followed by a strong Lucas test. This is the same test
+// mpz_probab_prime_p() starts with, and it has no known counterexample.
+template<unsigned Limbs>
+static bool FixedIsProbablePrime(const mpz_t& X) {
+  FixedMontgomery<Limbs> M;
+  M.Init(X);
+
+  if (!FixedIsSPRP2(M))
+    return false;
+
+  return FixedIsStrongLucasPRP(X, M);
+}
+
+// Probable-prime test that dispatches on the working bit width (-b):
+// 2, 3, 4 or 8 limbs, and GMP above 512 bits. A value wider than the
+// working width is sent to the next tier that can hold it.
+static inline bool IsProbablePrimeMP(const mpz_t& X, uint32_t Bits) {
+  if (mpz_cmp_ui(X, 97UL) <= 0) {
+    unsigned long V = mpz_get_ui(X);
+
+    for (unsigned I = 0U; I < FixedSmallPrimesCount; ++I) {
+      if (V == FixedSmallPrimes[I])
+        return true;
+    }
+
+    return false;
+  }
+
+  for (unsigned I = 0U; I < FixedSmallPrimesCount; ++I) {
+    if (mpz_divisible_ui_p(X, FixedSmallPrimes[I]))
+      return false;
+  }
+
+  size_t XS = mpz_size(X);
+
+  if (Bits <= 128U && XS <= 2UL)
+    return FixedIsProbablePrime<2>(X);
+  else if (Bits <= 192U && XS <= 3UL)
+    return FixedIsProbablePrime<3>(X);
+  else if (Bits <= 256U && XS <= 4UL)
+    return FixedIsProbablePrime<4>(X);
+  else if (Bits <= 512U && XS <= 8UL)
+    return FixedIsProbablePrime<8>(X);
+
+  return mpz_probab_prime_p(X, 25) != 0;
+}
+
+#endif // FIXEDMP_H
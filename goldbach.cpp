@@ -17,50 +17,109 @@
 
 #include <iostream>
 #include <string>
-#include <set>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
 #include <cmath>
+#include <ctime>
+#include <new>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #if defined(_OPENMP)
 #include <omp.h>
 #endif
 
-std::set<uint64_t> Primes;
+// Odd-only prime bitmap: bit I stands for 2 * I + 1 and is set if that
+// number is composite (or 1). The numbers up to N take N / 16 bytes,
+// and a membership test is one load and a bit test.
+static std::vector<uint64_t> Composite;
+static uint64_t Limit = 0UL;
 bool PrintPrimes = false;
 
-bool isprime(uint64_t N) {
-  if (N == 2) return true;
+// Words of the bitmap sieved per step: 256 KiB, 4194304 numbers.
+static const uint64_t SegmentWords = 1UL << 15;
 
-  if (!(N & 1) || (N == 0))
-    return false;
+inline bool isprime(uint64_t N) {
+  if (!(N & 1))
+    return N == 2;
 
-  uint64_t S = (uint64_t) ceill(sqrtl(N));
+  uint64_t I = N >> 1;
+  return !((Composite[I >> 6] >> (I & 63)) & 1UL);
+}
 
-  for (uint64_t I = 3UL; I <= S; ++I) {
-    if ((N % I) == 0)
-      return false;
-  }
+// The odd primes up to L, by a plain sieve.
+static void baseprimes(uint64_t L, std::vector<uint32_t>& P) {
+  std::vector<char> C(L + 1, 0);
 
-  return true;
+  for (uint64_t I = 3UL; I <= L; I += 2) {
+    if (C[I])
+      continue;
+
+    P.push_back((uint32_t) I);
+    for (uint64_t J = I * I; J <= L; J += 2 * I)
+      C[J] = 1;
+  }
 }
 
-inline void addprime(uint64_t N) {
-#pragma omp critical
-  Primes.insert(N);
+// Marks the odd composites of the words [W0, W1) of the bitmap.
+static void sievesegment(uint64_t W0, uint64_t W1,
+                         const std::vector<uint32_t>& P) {
+  uint64_t* B = Composite.data();
+  uint64_t Lo = W0 * 64UL;
+  uint64_t Hi = W1 * 64UL;
+  uint64_t NHi = 2 * Hi - 1;
+
+  for (size_t K = 0UL; K < P.size(); ++K) {
+    uint64_t Q = P[K];
+    if (Q * Q > NHi)
+      break;
+
+    // The first odd multiple of Q that is >= max(Q^2, 2 * Lo + 1).
+    uint64_t M = Q * Q;
+    if (M < 2 * Lo + 1) {
+      M = (2 * Lo + Q) / Q * Q;
+      if (!(M & 1))
+        M += Q;
+    }
+
+    for (uint64_t I = M >> 1; I < Hi; I += Q)
+      B[I >> 6] |= 1UL << (I & 63);
+  }
 }
 
 void findprimes(uint64_t N) {
-  Primes.insert(1);
-  Primes.insert(2);
-  Primes.insert(3);
+  Limit = N;
+
+  uint64_t Words = (N >> 1) / 64 + 1;
+  Composite.assign(Words, 0UL);
+
+  uint64_t R = (uint64_t) sqrtl((long double) N);
+  while (R * R > N)
+    --R;
+  while ((R + 1) * (R + 1) <= N)
+    ++R;
+
+  std::vector<uint32_t> P;
+  baseprimes(R, P);
+
+  uint64_t Segments = (Words + SegmentWords - 1) / SegmentWords;
 
 #if defined(_OPENMP)
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic)
 #endif
-  for (uint64_t I = 3; I < N; I += 2) {
-    if (isprime(I))
-      addprime(I);
+  for (uint64_t S = 0UL; S < Segments; ++S) {
+    uint64_t W1 = (S + 1) * SegmentWords;
+    sievesegment(S * SegmentWords, W1 < Words ? W1 : Words, P);
   }
+
+  // 1 is not prime.
+  Composite[0] |= 1UL;
 }
 
 bool checknumber(uint64_t N) {
@@ -76,22 +135,29 @@ bool checknumber(uint64_t N) {
 }
 
 static void printprimes() {
-  for (std::set<uint64_t>::iterator I = Primes.begin();
-       I != Primes.end(); ++I)
-    std::cerr << *I << std::endl;
+  if (Limit >= 2)
+    std::cerr << 2 << std::endl;
+
+  for (uint64_t I = 3UL; I <= Limit; I += 2) {
+    if (isprime(I))
+      std::cerr << I << std::endl;
+  }
 }
 
 bool goldbach(uint64_t N, std::pair<uint64_t, uint64_t>& R) {
   R.first  = 0UL;
   R.second = 0UL;
 
-  for (std::set<uint64_t>::iterator I = Primes.begin();
-       I != Primes.end(); ++I) {
-    uint64_t D = N - (*I);
+  if (N == 4) {
+    R.first = 2;
+    R.second = 2;
+    return true;
+  }
 
-    if (Primes.find(D) != Primes.end()) {
-      R.first = *I;
-      R.second = D;
+  for (uint64_t P = 3UL; P <= N / 2; P += 2) {
+    if (isprime(P) && isprime(N - P)) {
+      R.first = P;
+      R.second = N - P;
       return true;
     }
   }
@@ -99,9 +165,799 @@ bool goldbach(uint64_t N, std::pair<uint64_t, uint64_t>& R) {
   return false;
 }
 
+__extension__ typedef unsigned __int128 uint128_t;
+
+// Montgomery arithmetic modulo an odd 64-bit N, with R = 2^64.
+struct montgomery64 {
+  explicit montgomery64(uint64_t n) : N(n), NInv(n), One(0UL), R2(0UL) {
+    for (unsigned I = 0U; I < 5U; ++I)
+      NInv *= 2UL - N * NInv;
+
+    One = (uint64_t) ((((uint128_t) 1U) << 64) % N);
+    R2 = (uint64_t) ((uint128_t) One * One % N);
+  }
+
+  inline uint64_t mul(uint64_t A, uint64_t B) const {
+    uint128_t T = (uint128_t) A * B;
+    uint64_t M = (uint64_t) T * NInv;
+    uint64_t H = (uint64_t) (((uint128_t) M * N) >> 64);
+    uint64_t TH = (uint64_t) (T >> 64);
+
+    return TH >= H ? TH - H : TH - H + N;
+  }
+
+  inline uint64_t tomont(uint64_t A) const {
+    return mul(A % N, R2);
+  }
+
+  // B^E for B in Montgomery form.
+  inline uint64_t pow(uint64_t B, uint64_t E) const {
+    uint64_t X = One;
+
+    for ( ; E; E >>= 1) {
+      if (E & 1)
+        X = mul(X, B);
+      B = mul(B, B);
+    }
+
+    return X;
+  }
+
+  uint64_t N;
+  uint64_t NInv;
+  uint64_t One;
+  uint64_t R2;
+};
+
+// Deterministic Miller-Rabin for every N < 2^64 with Jim Sinclair's
+// seven bases.
+bool isprime64(uint64_t N) {
+  static const uint64_t Bases[] = {
+    2, 325, 9375, 28178, 450775, 9780504, 1795265022
+  };
+  static const uint64_t Small[] = { 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+
+  if (N < 2 || !(N & 1))
+    return N == 2;
+
+  for (size_t I = 0UL; I < sizeof(Small) / sizeof(Small[0]); ++I) {
+    if (N % Small[I] == 0)
+      return N == Small[I];
+  }
+
+  if (N < 37UL * 37UL)
+    return true;
+
+  montgomery64 M(N);
+  uint64_t D = N - 1;
+  unsigned S = (unsigned) __builtin_ctzl(D);
+  D >>= S;
+
+  uint64_t MinusOne = N - M.One;
+
+  for (size_t I = 0UL; I < sizeof(Bases) / sizeof(Bases[0]); ++I) {
+    uint64_t A = Bases[I] % N;
+    if (A == 0)
+      continue;
+
+    uint64_t X = M.pow(M.tomont(A), D);
+
+    if (X == M.One || X == MinusOne)
+      continue;
+
+    bool Composite = true;
+    for (unsigned J = 1U; J < S; ++J) {
+      X = M.mul(X, X);
+
+      if (X == MinusOne) {
+        Composite = false;
+        break;
+      }
+    }
+
+    if (Composite)
+      return false;
+  }
+
+  return true;
+}
+
+// Single query without the bitmap (-q N): p and N - p are both tested
+// with isprime64 for p = 3, 5, 7, ... The smallest p is tiny in practice
+// (a few thousand at most below 10^18), so the answer takes
+// microseconds and constant memory for any even N < 2^64.
+bool goldbach64(uint64_t N, std::pair<uint64_t, uint64_t>& R) {
+  R.first  = 0UL;
+  R.second = 0UL;
+
+  if (N == 4) {
+    R.first = 2;
+    R.second = 2;
+    return true;
+  }
+
+  for (uint64_t P = 3UL; P <= N / 2; P += 2) {
+    if (isprime64(P) && isprime64(N - P)) {
+      R.first = P;
+      R.second = N - P;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Range verification (-r A:B), after Oliveira e Silva, Herzog and
+// Pardi, "Empirical verification of the even Goldbach conjecture and
+// computation of prime gaps up to 4 * 10^18". The even n are taken 64 at
+// a time, and for p = 3, 5, 7, ... the window bitmap of the odd numbers
+// below them, shifted by p, flags at once the n for which n - p is
+// prime; those are settled and dropped until none is left. Each thread
+// sieves a contiguous chunk of the range window by window: the last
+// RangeMarginBits bits of a window are carried over to the next one, and
+// every base prime keeps its next offset, so no division is needed after
+// the first window. If no p <= RangeMargin works, the search goes on
+// with Miller-Rabin.
+
+static const uint64_t RangeMargin = 1UL << 16;
+static const uint64_t RangeMarginBits = RangeMargin / 2;
+// B leaves room below 2^64 for the last window, which runs up to 2^28
+// past B, and for the first multiple of a base prime Q < 2^32 above it.
+static const uint64_t RangeMaxB = ~0UL - (1UL << 33);
+static uint64_t ReportP = 0UL;
+
+struct range_stats {
+  range_stats() : Count(0UL), SumP(0UL), MaxP(0UL), MaxN(0UL),
+    Fallback(0UL), Large() { }
+
+  void merge(const range_stats& R) {
+    Count += R.Count;
+    SumP += R.SumP;
+    Fallback += R.Fallback;
+
+    if (R.MaxP > MaxP || (R.MaxP == MaxP && R.MaxN < MaxN)) {
+      MaxP = R.MaxP;
+      MaxN = R.MaxN;
+    }
+
+    Large.insert(Large.end(), R.Large.begin(), R.Large.end());
+  }
+
+  uint64_t Count;
+  uint64_t SumP;
+  uint64_t MaxP;
+  uint64_t MaxN;
+  uint64_t Fallback;
+  std::vector<std::pair<uint64_t, uint64_t>> Large;
+};
+
+// The smallest p with n - p prime, beyond the window.
+static uint64_t fallbackp(uint64_t N, uint64_t P) {
+  for (P += 2; P <= N / 2; P += 2) {
+    if (isprime64(P) && isprime64(N - P))
+      return P;
+  }
+
+  return 0UL;
+}
+
+// Records the smallest p of N, found in the window, or P = 0 to go on
+// with Miller-Rabin from Last. Returns false if N has no pair.
+static bool settle(range_stats& St, uint64_t N, uint64_t P, uint64_t Last) {
+  if (P == 0UL) {
+    P = fallbackp(N, Last);
+    ++St.Fallback;
+
+    if (P == 0UL) {
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+      std::cerr << "No Goldbach pair for " << N << "!" << std::endl;
+      return false;
+    }
+  }
+
+  ++St.Count;
+  St.SumP += P;
+
+  if (P > St.MaxP) {
+    St.MaxP = P;
+    St.MaxN = N;
+  }
+
+  if (ReportP && P >= ReportP)
+    St.Large.push_back(std::make_pair(N, P));
+
+  return true;
+}
+
+// Verifies the even n in [A, B] (A >= 6) with one window of Bits bits
+// at a time. Returns false if some n has no pair.
+static bool verifychunk(uint64_t A, uint64_t B, uint64_t Bits,
+                        const std::vector<uint32_t>& BaseP,
+                        const std::vector<uint32_t>& SmallP,
+                        range_stats& St) {
+  // One more word for the shifted reads at the end.
+  std::vector<uint64_t> W(Bits / 64 + 1, 0UL);
+  std::vector<uint32_t> Off(BaseP.size());
+  uint64_t* WB = W.data();
+
+  // The window holds the odd numbers Base, Base + 2, ...; the n checked
+  // in it are [Base + RangeMargin, Base + 2 * Bits), or from A on in the
+  // first window. Bits [From, Bits) are new in each window, and start
+  // at the odd number S.
+  uint64_t Base = A > RangeMargin ? ((A - RangeMargin) | 1UL) : 1UL;
+  uint64_t From = 0UL;
+  size_t Active = 0UL;
+  bool Ok = true;
+  uint64_t N = A;
+
+  while (Ok && N <= B) {
+    uint64_t S = Base + 2 * From;
+    uint64_t Top = Base + 2 * (Bits - 1);
+    uint64_t NewBits = Bits - From;
+
+    // A base prime Q joins once Q^2 is in the window; its offset is then
+    // below Q, and fits in 32 bits, from window to window.
+    while (Active < BaseP.size() &&
+           (uint64_t) BaseP[Active] * BaseP[Active] <= Top) {
+      uint64_t Q = BaseP[Active];
+      uint64_t M = Q * Q;
+
+      if (M < S) {
+        M = S + (Q - S % Q) % Q;
+        if (!(M & 1))
+          M += Q;
+      }
+
+      Off[Active++] = (uint32_t) ((M - S) / 2);
+    }
+
+    std::memset(WB + From / 64, 0, NewBits / 8);
+
+    for (size_t K = 0UL; K < Active; ++K) {
+      uint64_t Q = BaseP[K];
+      uint64_t I = From + Off[K];
+
+      for ( ; I < Bits; I += Q)
+        WB[I >> 6] |= 1UL << (I & 63);
+
+      Off[K] = (uint32_t) (I - Bits);
+    }
+
+    if (Base == 1)
+      WB[0] |= 1UL;
+
+    while (Ok && N < Base + 2 * Bits && N <= B) {
+      uint64_t Cnt = std::min<uint64_t>(std::min((Base + 2 * Bits - 1 - N) / 2,
+                                                 (B - N) / 2) + 1, 64);
+
+      // Only the first n of a range can be too small for the word path.
+      if (N < 2 * RangeMargin || N < Base + RangeMargin) {
+        uint64_t P = 0UL;
+
+        for (size_t K = 0UL; K < SmallP.size(); ++K) {
+          uint64_t Q = SmallP[K];
+          if (Q > N / 2)
+            break;
+
+          uint64_t I = (N - Q - Base) / 2;
+          if (!((WB[I >> 6] >> (I & 63)) & 1UL)) {
+            P = Q;
+            break;
+          }
+        }
+
+        Ok = settle(St, N, P, SmallP.back());
+        N += 2;
+        continue;
+      }
+
+      // Bit J of U stands for n = N + 2 * J, not settled yet. For each p,
+      // the composite flags of the n - p are the window bits from
+      // (N - p - Base) / 2 on, one shifted word.
+      uint64_t U = Cnt == 64 ? ~0UL : (1UL << Cnt) - 1;
+
+      for (size_t K = 0UL; U && K < SmallP.size(); ++K) {
+        uint64_t Q = SmallP[K];
+        uint64_t I = (N - Q - Base) / 2;
+        uint64_t Sh = I & 63;
+        uint64_t C = WB[I >> 6] >> Sh;
+        if (Sh)
+          C |= WB[(I >> 6) + 1] << (64 - Sh);
+
+        uint64_t S = U & ~C;
+        if (!S)
+          continue;
+
+        U &= C;
+        St.Count += (uint64_t) __builtin_popcountl(S);
+        St.SumP += Q * (uint64_t) __builtin_popcountl(S);
+
+        if (Q > St.MaxP) {
+          St.MaxP = Q;
+          St.MaxN = N + 2 * (uint64_t) __builtin_ctzl(S);
+        }
+
+        if (ReportP && Q >= ReportP) {
+          for ( ; S; S &= S - 1)
+            St.Large.push_back(std::make_pair(N + 2 * (uint64_t)
+                                              __builtin_ctzl(S), Q));
+        }
+      }
+
+      for ( ; Ok && U; U &= U - 1)
+        Ok = settle(St, N + 2 * (uint64_t) __builtin_ctzl(U), 0UL,
+                    SmallP.back());
+
+      N += 2 * Cnt;
+    }
+
+    // The next window starts RangeMargin below its first n.
+    std::memmove(WB, WB + (Bits - RangeMarginBits) / 64, RangeMarginBits / 8);
+    Base += 2 * (Bits - RangeMarginBits);
+    From = RangeMarginBits;
+  }
+
+  return Ok;
+}
+
+static int verifyrange(uint64_t A, uint64_t B) {
+  range_stats St;
+  uint64_t First = A < 4 ? 4 : A + (A & 1);
+
+  if (A < 4)
+    A = 4;
+  if (A & 1)
+    ++A;
+
+  if (A == 4 && A <= B) {
+    ++St.Count;
+    St.SumP += 2;
+    St.MaxP = 2;
+    St.MaxN = 4;
+    if (ReportP && 2 >= ReportP)
+      St.Large.push_back(std::make_pair(4UL, 2UL));
+    A = 6;
+  }
+
+  if (A > B) {
+    std::cerr << "No even numbers >= 4 in the range!" << std::endl;
+    return 1;
+  }
+
+  // The base primes up to sqrt(B) sieve the windows; the small primes
+  // are the p tried for every n.
+  uint64_t R = (uint64_t) sqrtl((long double) B);
+  while (R * R > B)
+    --R;
+  while ((R + 1) * (R + 1) <= B && R < 0xffffffffUL)
+    ++R;
+
+  uint64_t L = R > RangeMargin ? R : RangeMargin;
+  findprimes(L);
+
+  std::vector<uint32_t> BaseP;
+  std::vector<uint32_t> SmallP;
+
+  for (uint64_t I = 3UL; I <= L; I += 2) {
+    if (!isprime(I))
+      continue;
+
+    if (I <= R)
+      BaseP.push_back((uint32_t) I);
+    if (I <= RangeMargin)
+      SmallP.push_back((uint32_t) I);
+  }
+
+  std::vector<uint64_t>().swap(Composite);
+
+  // Windows of at least 2^22 bits, and more for large B so that walking
+  // the base primes stays cheap per n.
+  uint64_t Bits = 1UL << 22;
+  while (Bits < (1UL << 27) && Bits < R / 16)
+    Bits <<= 1;
+
+  int T = 1;
+#if defined(_OPENMP)
+  T = omp_get_max_threads();
+#endif
+
+  uint64_t Evens = (B - A) / 2 + 1;
+  uint64_t Chunks = std::min<uint64_t>((uint64_t) T * 4,
+                                       Evens / Bits + 1);
+  uint64_t ChunkEvens = (Evens + Chunks - 1) / Chunks;
+  bool Ok = true;
+
+  struct timespec T0;
+  struct timespec T1;
+  (void) clock_gettime(CLOCK_MONOTONIC, &T0);
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (uint64_t C = 0UL; C < Chunks; ++C) {
+    uint64_t CA = A + 2 * C * ChunkEvens;
+    if (CA > B || CA < A)
+      continue;
+
+    uint64_t CB = B - CA < 2 * (ChunkEvens - 1) ? B :
+      CA + 2 * (ChunkEvens - 1);
+    range_stats CS;
+    bool COk = verifychunk(CA, CB, Bits, BaseP, SmallP, CS);
+
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+    {
+      St.merge(CS);
+      Ok = Ok && COk;
+    }
+  }
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &T1);
+  double Sec = (double) (T1.tv_sec - T0.tv_sec) +
+    (double) (T1.tv_nsec - T0.tv_nsec) / 1e9;
+
+  std::sort(St.Large.begin(), St.Large.end());
+  for (size_t I = 0UL; I < St.Large.size(); ++I)
+    std::cout << St.Large[I].first << " = " << St.Large[I].second << " + "
+      << St.Large[I].first - St.Large[I].second << std::endl;
+
+  std::cout << "Verified " << St.Count << " even numbers in [" << First
+    << ", " << B << "]" << std::endl;
+  std::cout << "Mean smallest p: " << (double) St.SumP / (double) St.Count
+    << std::endl;
+  std::cout << "Largest smallest p: " << St.MaxP << " for n = " << St.MaxN
+    << std::endl;
+  if (St.Fallback)
+    std::cout << "Beyond the window (p > " << RangeMargin << "): "
+      << St.Fallback << std::endl;
+  std::cout << "Time: " << Sec << " s, " << (double) St.Count / Sec / 1e6
+    << " million n/s" << std::endl;
+
+  return Ok ? 0 : 1;
+}
+
+// -r <a>:<b>.
+static bool parserange(const char* S, uint64_t& A, uint64_t& B) {
+  char* E;
+  errno = 0;
+  A = std::strtoul(S, &E, 10);
+  if (E == S || *E != ':' || errno)
+    return false;
+
+  const char* S2 = E + 1;
+  B = std::strtoul(S2, &E, 10);
+  return E != S2 && *E == '\0' && !errno && A <= B && S[0] != '-' &&
+    S2[0] != '-';
+}
+
+// Goldbach partition counts (-c N): g(n), the number of ways to write n
+// as p + q with p <= q, for every even n <= N. With x[i] = 1 if 2 * i + 1
+// is an odd prime, the self-convolution c = x * x counts the ordered
+// pairs of odd primes with sum 2 * k + 2, and
+//
+//   g(2 * k + 2) = (c[k] + x[k / 2] for even k) / 2.
+//
+// c is computed exactly with a number theoretic transform modulo a prime
+// above every count. x is cut into Blocks blocks of L entries; the
+// transform of each block, zero-padded to 2 * L, is kept in a store, and
+// output block s is the inverse transform of the sum of F[a] * F[s - a]
+// plus the upper half carried over from block s - 1. With one block this
+// is a single O(N log N) convolution; the block size follows the memory
+// size, and a store beyond half of it goes to a temporary file.
+
+// 29 * 2^57 + 1, with primitive root 3: transforms of up to 2^57 points.
+static const uint64_t NTTPrime = 4179340454199820289UL;
+static const uint64_t NTTRoot = 3UL;
+
+// Transform stages whose butterflies stay within NTTBlock words (256 KiB)
+// are done one block at a time, in cache, instead of one pass over the
+// whole array per stage.
+static const uint64_t NTTBlock = 1UL << 15;
+
+// The transforms work on plain residues kept below 2 or 4 times the
+// prime and multiply by the fixed roots with Shoup's precomputed
+// quotients (Harvey's butterflies); the pointwise products are
+// Montgomery products, whose factor 1 / 2^64 is undone with the final
+// scaling.
+struct ntt_plan {
+  explicit ntt_plan(uint64_t n) : Size(n), Block(n < NTTBlock ? n : NTTBlock),
+    M(NTTPrime), W(n), WS(n), Scale(0UL) {
+    uint64_t H = n / 2;
+    uint64_t R = M.pow(M.tomont(NTTRoot), (NTTPrime - 1) / n);
+    uint64_t X = M.One;
+
+    for (uint64_t J = 0UL; J < H; ++J) {
+      W[H + J] = M.mul(X, 1UL);
+      WS[H + J] = (uint64_t) (((uint128_t) W[H + J] << 64) / NTTPrime);
+      X = M.mul(X, R);
+    }
+
+    for (uint64_t Len = H / 2; Len; Len >>= 1) {
+      for (uint64_t J = 0UL; J < Len; ++J) {
+        W[Len + J] = W[2 * Len + 2 * J];
+        WS[Len + J] = WS[2 * Len + 2 * J];
+      }
+    }
+
+    // 2^128 / n: the Montgomery product with it scales by 1 / n and
+    // restores the 2^64 lost in the pointwise products.
+    Scale = M.tomont(M.tomont(NTTPrime - (NTTPrime - 1) / n));
+  }
+
+  inline uint64_t add(uint64_t A, uint64_t B) const {
+    uint64_t S = A + B;
+    return S >= NTTPrime ? S - NTTPrime : S;
+  }
+
+  // X * W[I] modulo the prime, in [0, 2 * NTTPrime), for any X.
+  inline uint64_t mulroot(uint64_t X, uint64_t I) const {
+    uint64_t Q = (uint64_t) (((uint128_t) X * WS[I]) >> 64);
+    return X * W[I] - Q * NTTPrime;
+  }
+
+  // The DIF butterfly of the stage with half-length Len; [0, 2p) in and
+  // out.
+  inline void forward(uint64_t* A, uint64_t Len, uint64_t J) const {
+    uint64_t U = A[J];
+    uint64_t V = A[J + Len];
+    uint64_t S = U + V;
+
+    A[J] = S >= 2 * NTTPrime ? S - 2 * NTTPrime : S;
+    A[J + Len] = mulroot(U - V + 2 * NTTPrime, Len + J);
+  }
+
+  // The DIT butterfly with the inverse root w^-J = -w^(Len - J); [0, 4p)
+  // in and out.
+  inline void inverse(uint64_t* A, uint64_t Len, uint64_t J) const {
+    uint64_t U = A[J];
+    if (U >= 2 * NTTPrime)
+      U -= 2 * NTTPrime;
+
+    if (J) {
+      uint64_t V = mulroot(A[J + Len], 2 * Len - J);
+      A[J] = U - V + 2 * NTTPrime;
+      A[J + Len] = U + V;
+    } else {
+      uint64_t V = mulroot(A[J + Len], Len);
+      A[J] = U + V;
+      A[J + Len] = U - V + 2 * NTTPrime;
+    }
+  }
+
+  uint64_t Size;
+  uint64_t Block;
+  montgomery64 M;
+  // W[Len + J] = w^J for the 2 * Len-th root of unity w, Len = 1 .. n / 2,
+  // and WS[Len + J] = floor(W[Len + J] * 2^64 / p).
+  std::vector<uint64_t> W;
+  std::vector<uint64_t> WS;
+  uint64_t Scale;
+};
+
+// Decimation in frequency: natural order in, bit-reversed order out.
+static void nttforward(const ntt_plan& T, uint64_t* A) {
+  uint64_t H = T.Size / 2;
+  uint64_t Len = H;
+
+  for ( ; Len >= T.Block; Len >>= 1) {
+    unsigned LB = (unsigned) __builtin_ctzl(Len);
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static)
+#endif
+    for (uint64_t K = 0UL; K < H; ++K) {
+      uint64_t J = K & (Len - 1);
+      T.forward(A + ((K >> LB) << (LB + 1)), Len, J);
+    }
+  }
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static)
+#endif
+  for (uint64_t B = 0UL; B < T.Size; B += T.Block) {
+    for (uint64_t L = T.Block / 2; L; L >>= 1) {
+      for (uint64_t I = B; I < B + T.Block; I += 2 * L) {
+        for (uint64_t J = 0UL; J < L; ++J)
+          T.forward(A + I, L, J);
+      }
+    }
+  }
+}
+
+// Decimation in time: bit-reversed order in, natural order out, not yet
+// scaled by 1 / n and below 4p.
+static void nttinverse(const ntt_plan& T, uint64_t* A) {
+  uint64_t H = T.Size / 2;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static)
+#endif
+  for (uint64_t B = 0UL; B < T.Size; B += T.Block) {
+    for (uint64_t L = 1UL; L < T.Block; L <<= 1) {
+      for (uint64_t I = B; I < B + T.Block; I += 2 * L) {
+        for (uint64_t J = 0UL; J < L; ++J)
+          T.inverse(A + I, L, J);
+      }
+    }
+  }
+
+  for (uint64_t Len = T.Block; Len <= H; Len <<= 1) {
+    unsigned LB = (unsigned) __builtin_ctzl(Len);
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static)
+#endif
+    for (uint64_t K = 0UL; K < H; ++K) {
+      uint64_t J = K & (Len - 1);
+      T.inverse(A + ((K >> LB) << (LB + 1)), Len, J);
+    }
+  }
+}
+
+// Memory for the block transforms: anonymous if it takes at most half of
+// the physical memory, else an unlinked file under $TMPDIR.
+static uint64_t* mapstore(size_t Bytes, uint64_t Phys) {
+  int FD = -1;
+  int Flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+  if (Bytes > Phys / 2) {
+    const char* D = std::getenv("TMPDIR");
+    std::string Path = std::string(D && *D ? D : "/tmp") +
+      "/goldbach.XXXXXX";
+
+    FD = mkstemp(&Path[0]);
+    if (FD < 0)
+      return NULL;
+
+    (void) unlink(Path.c_str());
+    if (ftruncate(FD, (off_t) Bytes) != 0) {
+      (void) close(FD);
+      return NULL;
+    }
+
+    Flags = MAP_SHARED;
+  }
+
+  void* B = mmap(NULL, Bytes, PROT_READ | PROT_WRITE, Flags, FD, 0);
+  if (FD >= 0)
+    (void) close(FD);
+
+  return B == MAP_FAILED ? NULL : static_cast<uint64_t*>(B);
+}
+
+static void appenddecimal(std::string& S, uint64_t V) {
+  char B[20];
+  size_t L = 0UL;
+
+  do {
+    B[L++] = (char) ('0' + V % 10);
+    V /= 10;
+  } while (V);
+
+  while (L)
+    S += B[--L];
+}
+
+static int countpartitions(uint64_t N) {
+  struct timespec T0;
+  struct timespec T1;
+  (void) clock_gettime(CLOCK_MONOTONIC, &T0);
+
+  findprimes(N);
+
+  // x[i] for i < Odd, the odd numbers below N.
+  uint64_t Odd = N / 2;
+  uint64_t Phys = (uint64_t) sysconf(_SC_PHYS_PAGES) *
+    (uint64_t) sysconf(_SC_PAGESIZE);
+
+  // A block of L entries needs about 88 * L bytes of working memory.
+  uint64_t L = 1UL << 10;
+  while (L < Odd && 128 * L <= Phys / 4)
+    L <<= 1;
+
+  uint64_t Blocks = (Odd + L - 1) / L;
+  size_t StoreBytes = (size_t) (Blocks * 2 * L * sizeof(uint64_t));
+  uint64_t* F = mapstore(StoreBytes, Phys);
+
+  if (F == NULL) {
+    std::cerr << "Could not allocate the " << StoreBytes
+      << " byte transform store: " << std::strerror(errno) << "!"
+      << std::endl;
+    return 1;
+  }
+
+  ntt_plan T(2 * L);
+  std::vector<uint64_t> G(2 * L);
+  std::vector<uint64_t> Carry(L, 0UL);
+  const uint64_t* C = Composite.data();
+
+  std::string Out("4 1\n");
+
+  for (uint64_t S = 0UL; S < Blocks; ++S) {
+    uint64_t* FS = F + S * 2 * L;
+    uint64_t I0 = S * L;
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static)
+#endif
+    for (uint64_t J = 0UL; J < 2 * L; ++J) {
+      uint64_t I = I0 + J;
+      FS[J] = J < L && I < Odd && !((C[I >> 6] >> (I & 63)) & 1UL);
+    }
+
+    nttforward(T, FS);
+
+    // F[a] * F[s - a] and F[s - a] * F[a] are the same product.
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static)
+#endif
+    for (uint64_t J = 0UL; J < 2 * L; ++J) {
+      uint64_t X = 0UL;
+
+      for (uint64_t A = 0UL; 2 * A <= S; ++A) {
+        uint64_t P = T.M.mul(F[A * 2 * L + J], F[(S - A) * 2 * L + J]);
+        X = T.add(X, P);
+        if (2 * A != S)
+          X = T.add(X, P);
+      }
+
+      G[J] = X;
+    }
+
+    nttinverse(T, G.data());
+
+    for (uint64_t J = 0UL; J < L && I0 + J < Odd; ++J) {
+      uint64_t K = I0 + J;
+      uint64_t CK = T.M.mul(G[J], T.Scale) + Carry[J];
+
+      Carry[J] = T.M.mul(G[L + J], T.Scale);
+      if (K < 2)
+        continue;
+
+      if (!(K & 1) && !((C[(K / 2) >> 6] >> ((K / 2) & 63)) & 1UL))
+        ++CK;
+
+      appenddecimal(Out, 2 * K + 2);
+      Out += ' ';
+      appenddecimal(Out, CK / 2);
+      Out += '\n';
+
+      if (Out.size() >= (1UL << 16)) {
+        (void) std::fwrite(Out.data(), 1, Out.size(), stdout);
+        Out.clear();
+      }
+    }
+  }
+
+  (void) std::fwrite(Out.data(), 1, Out.size(), stdout);
+  (void) std::fflush(stdout);
+  (void) munmap(F, StoreBytes);
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &T1);
+  double Sec = (double) (T1.tv_sec - T0.tv_sec) +
+    (double) (T1.tv_nsec - T0.tv_nsec) / 1e9;
+
+  std::cerr << "Counted the partitions of the " << (Odd > 1 ? Odd - 1 : 0)
+    << " even n in [4, " << N << "] in " << Sec << " s (" << Blocks
+    << " block" << (Blocks == 1 ? "" : "s") << " of " << L << ")"
+    << std::endl;
+  return 0;
+}
+
 void printUsage() {
   std::cerr << "Usage: goldbach -N <even-integer>" << std::endl
     << "             [ -P (print prime numbers up to N) ]" << std::endl
+    << "       goldbach -q <even-integer> (no sieve, any N < 2^64)"
+    << std::endl
+    << "       goldbach -r <A>:<B> (verify every even n in [A, B])"
+    << std::endl
+    << "             [ -p <p> (print every n whose smallest p is >= p) ]"
+    << std::endl
+    << "       goldbach -c <N> (number of partitions of every even n <= N)"
+    << std::endl
     << "             [ -h (print this help message) ]" << std::endl;
 }
 
@@ -113,10 +969,40 @@ int main(int argc, char* argv[])
   }
 
   uint64_t N = 0UL;
+  uint64_t A = 0UL;
+  uint64_t B = 0UL;
+  uint64_t Count = 0UL;
+  uint64_t Query = 0UL;
+  bool Range = false;
   int c;
 
-  while ((c = getopt(argc, argv, "hPN:")) != -1) {
+  while ((c = getopt(argc, argv, "hPN:q:r:p:c:")) != -1) {
     switch (c) {
+    case 'r':
+      if (!parserange(optarg, A, B)) {
+        std::cerr << "Invalid range " << optarg << "!" << std::endl;
+        return 1;
+      }
+      if (B > RangeMaxB) {
+        std::cerr << "The end of the range must be <= " << RangeMaxB
+          << "!" << std::endl;
+        return 1;
+      }
+      Range = true;
+      break;
+    case 'p':
+      ReportP = std::stoul(optarg);
+      break;
+    case 'q':
+      Query = std::stoul(optarg);
+      if (!checknumber(Query))
+        return 1;
+      break;
+    case 'c':
+      Count = std::stoul(optarg);
+      if (!checknumber(Count))
+        return 1;
+      break;
     case 'P':
       PrintPrimes = true;
       break;
@@ -132,13 +1018,55 @@ int main(int argc, char* argv[])
     }
   }
 
-  findprimes(N);
+  if ((Count != 0UL) + (Query != 0UL) + (N != 0UL) + Range > 1) {
+    printUsage();
+    return 1;
+  }
 
-  if (PrintPrimes)
-    printprimes();
+  if (Count) {
+    try {
+      return countpartitions(Count);
+    } catch (const std::bad_alloc&) {
+      std::cerr << "Could not allocate memory for N=" << Count << "!"
+        << std::endl;
+      return 1;
+    }
+  }
+
+  if (Range)
+    return verifyrange(A, B);
 
   std::pair<uint64_t, uint64_t> R;
 
+  if (Query) {
+    if (!goldbach64(Query, R)) {
+      std::cerr << "Could not find a pair of prime numbers "
+        << "to satisfy Goldbach's Conjecture." << std::endl;
+      return 1;
+    }
+
+    std::cout << "Goldbach's Conjecture for " << Query
+      << " is satisfied by " << R.first << " + "
+      << R.second << "." << std::endl;
+    return 0;
+  }
+
+  if (N == 0UL) {
+    printUsage();
+    return 1;
+  }
+
+  try {
+    findprimes(N);
+  } catch (const std::bad_alloc&) {
+    std::cerr << "Could not allocate the " << (N >> 1) / 64 * 8 + 8
+      << " byte prime bitmap for N=" << N << "!" << std::endl;
+    return 1;
+  }
+
+  if (PrintPrimes)
+    printprimes();
+
   if (!goldbach(N, R)) {
     std::cerr << "Could not find a pair of prime numbers "
       << "to satisfy Goldbach's Conjecture." << std::endl;
@@ -0,0 +1,318 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#include "fixedmp.h"
+#include "prodtree.h"
+
+// Goldbach decompositions N = p + q of arbitrary precision even N, with
+// the smallest p. The odd p are taken a window of WindowBits at a time.
+// One sieve over the window removes the composite p and every p for
+// which some prime r <= SieveLimit divides N - p: with N mod r computed
+// once, those p are p = N mod r (mod r), one arithmetic progression per
+// r. Only the survivors get a probable-prime test of N - p, on a pool of
+// threads, in increasing order of p; the first q = N - p that passes
+// ends the search.
+
+static const uint64_t WindowBits = 1UL << 16;
+
+// The p themselves are sieved with the primes below 2^16, which is exact
+// for every p < 2^32.
+static const uint32_t PLimit = 1U << 16;
+static const uint64_t PMax = 1UL << 32;
+
+static uint32_t SieveLimit = 1U << 20;
+static uint32_t NThreads = 0U;
+
+struct goldbach_job {
+  goldbach_job() : Bits(0U), Survivors(), Next(0UL), Best(~0UL),
+    Tested(0UL) { }
+
+  mpz_t N;
+  uint32_t Bits;
+  std::vector<uint64_t> Survivors;
+  std::atomic<size_t> Next;
+  std::atomic<size_t> Best;
+  std::atomic<uint64_t> Tested;
+};
+
+static struct timespec ts_begin = { 0, 0 };
+static struct timespec ts_end = { 0, 0 };
+
+extern "C" {
+  static void* goldbach_thread_start(void* Arg) {
+    goldbach_job& J = *static_cast<goldbach_job*>(Arg);
+    mpz_t Q;
+    mpz_init2(Q, J.Bits);
+
+    for (;;) {
+      size_t I = J.Next.fetch_add(1UL, std::memory_order_relaxed);
+      if (I >= J.Survivors.size() ||
+          I > J.Best.load(std::memory_order_relaxed))
+        break;
+
+      mpz_sub_ui(Q, J.N, J.Survivors[I]);
+      J.Tested.fetch_add(1UL, std::memory_order_relaxed);
+
+      if (!IsProbablePrimeMP(Q, J.Bits))
+        continue;
+
+      // Keep the smallest index; a later one may finish first.
+      size_t B = J.Best.load(std::memory_order_relaxed);
+      while (I < B && !J.Best.compare_exchange_weak(B, I))
+        ;
+    }
+
+    mpz_clear(Q);
+    return NULL;
+  }
+}
+
+// For the odd p = V0 + 2 * I of the window, sets PC[I] if p is
+// composite (or 1) and NC[I] if N - p has a prime factor r <= SieveLimit
+// other than N - p itself.
+static void SieveWindow(uint64_t V0, const std::vector<uint32_t>& PPrimes,
+                        const std::vector<uint32_t>& Primes,
+                        const std::vector<uint32_t>& Residues,
+                        bool Small, uint64_t N64, std::vector<bool>& PC,
+                        std::vector<bool>& NC) {
+  uint64_t VE = V0 + 2UL * WindowBits;
+
+  PC.assign(WindowBits, false);
+  NC.assign(WindowBits, false);
+
+  if (V0 == 1UL)
+    PC[0] = true;
+
+  for (size_t K = 1UL; K < PPrimes.size(); ++K) {
+    uint64_t Q = PPrimes[K];
+    if (Q * Q >= VE)
+      break;
+
+    // The first odd multiple of Q that is >= max(Q^2, V0).
+    uint64_t M = Q * Q;
+    if (M < V0) {
+      M = (V0 + Q - 1UL) / Q * Q;
+      if (!(M & 1UL))
+        M += Q;
+    }
+
+    for (uint64_t I = (M - V0) / 2UL; I < WindowBits; I += Q)
+      PC[I] = true;
+  }
+
+  // p = N (mod r), and odd. Primes[0] is 2, and N - p is odd.
+  for (size_t K = 1UL; K < Primes.size(); ++K) {
+    uint64_t R = Primes[K];
+    uint64_t V = V0 + (Residues[K] + R - V0 % R) % R;
+    if (!(V & 1UL))
+      V += R;
+
+    for (uint64_t I = (V - V0) / 2UL; I < WindowBits; I += R) {
+      if (Small && V0 + 2UL * I == N64 - R)
+        continue;
+
+      NC[I] = true;
+    }
+  }
+}
+
+static int32_t Goldbach(const char* Arg) {
+  goldbach_job J;
+  mpz_init(J.N);
+
+  if (mpz_set_str(J.N, Arg, 10) != 0 || mpz_sgn(J.N) <= 0) {
+    std::cerr << "Error: " << Arg << " is not an unsigned integer!"
+      << std::endl;
+    mpz_clear(J.N);
+    return 1;
+  }
+
+  if (mpz_cmp_ui(J.N, 4UL) < 0 || mpz_odd_p(J.N)) {
+    std::cerr << "Error: " << Arg << " is not an even number >= 4!"
+      << std::endl;
+    mpz_clear(J.N);
+    return 1;
+  }
+
+  J.Bits = (uint32_t) mpz_sizeinbase(J.N, 2);
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts_begin);
+
+  std::vector<uint32_t> PPrimes;
+  std::vector<uint32_t> Primes;
+  std::vector<uint32_t> Residues;
+  SievePrimes(PLimit, PPrimes);
+  SievePrimes(SieveLimit, Primes);
+
+  Residues.resize(Primes.size());
+  for (size_t K = 0UL; K < Primes.size(); ++K)
+    Residues[K] = (uint32_t) mpz_fdiv_ui(J.N, Primes[K]);
+
+  // For N < 2^64, N - p may be one of the sieving primes itself, and p
+  // stops at N / 2.
+  bool Small = mpz_fits_ulong_p(J.N) != 0;
+  uint64_t N64 = Small ? mpz_get_ui(J.N) : 0UL;
+  uint64_t PEnd = Small && N64 / 2UL < PMax ? N64 / 2UL + 1UL : PMax;
+
+  uint64_t Candidates = 0UL;
+  uint64_t SievedOut = 0UL;
+  uint64_t P = 0UL;
+  std::vector<bool> PC;
+  std::vector<bool> NC;
+  std::vector<pthread_t> TID(NThreads);
+
+  if (mpz_cmp_ui(J.N, 4UL) == 0) {
+    P = 2UL;
+    Candidates = 1UL;
+  }
+
+  for (uint64_t V0 = 1UL; P == 0UL && V0 < PEnd; V0 += 2UL * WindowBits) {
+    SieveWindow(V0, PPrimes, Primes, Residues, Small, N64, PC, NC);
+
+    // The prime p of the window, and the ones left for a test.
+    std::vector<uint64_t> All;
+    J.Survivors.clear();
+
+    for (uint64_t I = 0UL; I < WindowBits; ++I) {
+      uint64_t V = V0 + 2UL * I;
+      if (V >= PEnd)
+        break;
+
+      if (PC[I])
+        continue;
+
+      All.push_back(V);
+      if (!NC[I])
+        J.Survivors.push_back(V);
+    }
+
+    J.Next.store(0UL);
+    J.Best.store(~0UL);
+
+    for (uint32_t I = 0U; I < NThreads; ++I)
+      (void) pthread_create(&TID[I], NULL, goldbach_thread_start, &J);
+
+    for (uint32_t I = 0U; I < NThreads; ++I)
+      (void) pthread_join(TID[I], NULL);
+
+    size_t B = J.Best.load();
+    if (B != ~0UL)
+      P = J.Survivors[B];
+
+    // Count the p up to the answer, or the whole window.
+    uint64_t W = 0UL;
+    while (W < All.size() && (P == 0UL || All[W] <= P))
+      ++W;
+
+    Candidates += W;
+    SievedOut += W - (P ? B + 1UL : J.Survivors.size());
+  }
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+  double S = (double) (ts_end.tv_sec - ts_begin.tv_sec) +
+    (double) (ts_end.tv_nsec - ts_begin.tv_nsec) / 1e9;
+
+  if (P == 0UL) {
+    std::cerr << "Could not find a pair of prime numbers with p < " << PEnd
+      << " to satisfy Goldbach's Conjecture." << std::endl;
+    mpz_clear(J.N);
+    return 1;
+  }
+
+  mpz_t Q;
+  mpz_init(Q);
+  mpz_sub_ui(Q, J.N, P);
+
+  std::cout << "Goldbach's Conjecture for " << Arg << " is satisfied by "
+    << P << " + ";
+  char* QS = mpz_get_str(NULL, 10, Q);
+  // Baillie-PSW has no counterexample below 2^64.
+  std::cout << QS << (mpz_sizeinbase(Q, 2) > 64UL ? " (probable prime)" : "")
+    << "." << std::endl;
+
+  void (*Free)(void*, size_t);
+  mp_get_memory_functions(NULL, NULL, &Free);
+  Free(QS, std::strlen(QS) + 1UL);
+
+  (void) std::fprintf(stdout, "Primes p up to %lu: %lu, sieved out: %lu "
+                      "(%.1f%%), probable-prime tests: %lu\n",
+                      (unsigned long) P, (unsigned long) Candidates,
+                      (unsigned long) SievedOut,
+                      100.0 * (double) SievedOut / (double) Candidates,
+                      (unsigned long) J.Tested.load());
+  (void) std::fprintf(stdout, "Sieve limit %u, %u threads, %.3f s\n",
+                      SieveLimit, NThreads, S);
+
+  mpz_clear(Q);
+  mpz_clear(J.N);
+  return 0;
+}
+
+static void PrintUsage() {
+  std::cerr << "Usage: goldbachmp <even-integer>" << std::endl;
+  std::cerr << "                  [ -B <sieve-limit> (default 1048576, "
+    << "0 = off)]" << std::endl;
+  std::cerr << "                  [ -T <number-of-threads> (default all CPUs)]"
+    << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hB:T:")) != -1) {
+    switch (opt) {
+    case 'B':
+      SieveLimit = (uint32_t) std::stoul(optarg);
+      break;
+    case 'T':
+      NThreads = (uint32_t) std::stoul(optarg);
+      break;
+    case 'h':
+      PrintUsage();
+      return 0;
+    default:
+      PrintUsage();
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1) {
+    PrintUsage();
+    return 1;
+  }
+
+  if (NThreads == 0U)
+    NThreads = (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+  if (NThreads == 0U)
+    NThreads = 1U;
+
+  return Goldbach(argv[optind]);
+}
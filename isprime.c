@@ -19,7 +19,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <math.h>
+#include <string.h>
+
+#include "uint128.h"
 
 int main(int argc, char* argv[])
 {
@@ -28,26 +30,21 @@ int main(int argc, char* argv[])
     return 1;
   }
 
-  bool NP = false;
-  uint64_t X = strtoul(argv[1], NULL, 10);
+  uint128_t X;
 
-  if (!(X & 1) || (X == 0UL) || X == 2UL) {
-    NP = true;
-    goto shortcut;
+  if (!ParseUInt128(argv[1], argv[1] + strlen(argv[1]), &X)) {
+    (void) fprintf(stderr, "Error: %s is not an unsigned integer below "
+                   "2^128!\n", argv[1]);
+    return 1;
   }
 
-  uint64_t S = (uint64_t) sqrt(X);
-
-  for (uint64_t I = 3; I <= S; I += 2) {
-    if ((X % I) == 0) {
-      NP = true;
-      goto shortcut;
-    }
-  }
+  // Miller-Rabin in 128-bit Montgomery arithmetic for every size; it is
+  // deterministic up to 2^81, so 64-bit inputs need no trial division.
+  char B[UINT128_MAX_DIGITS];
+  char* E = FormatUInt128(B, X);
 
-shortcut:
-  (void) fprintf(stdout, "%lu is %s.\n",
-                 X, (NP ? "not prime" : "prime"));
+  (void) fprintf(stdout, "%.*s is %s.\n", (int) (E - B), B,
+                 (IsPrime128(X) ? "prime" : "not prime"));
   return 0;
 }
 
@@ -1,12 +1,21 @@
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <vector>
 #include <cstring>
 #include <cmath>
 #include <ctime>
 #include <unistd.h>
 #include <gmp.h>
 
+#include "fixedmp.h"
+#include "prodtree.h"
+#include "proth.h"
+
 uint32_t Bits = 128;
+uint32_t PrimeBound = static_cast<uint32_t>(~0x0);
+static const size_t BatchSize = 256UL;
+static uint32_t FactorBits = 0U;
 
 int32_t NotPrime(const char* argv) {
   std::cerr << argv << " is not prime." << std::endl;
@@ -54,79 +63,336 @@ int32_t IsBigPrime(const char* argv, size_t SL) {
     break;
   }
 
-  bool NP = false;
-
   mpz_t X;
   mpz_init2(X, Bits);
   mpz_set_str(X, argv, 10);
 
-  mpz_t SQRT;
-  mpz_t ON;
-  mpz_init2(SQRT, Bits);
-  mpz_init2(ON, Bits);
+  bool P = IsProbablePrimeMP(X, Bits);
+
+  mpz_clear(X);
+
+  return P ? Prime(argv) : NotPrime(argv);
+}
+
+// Tests a batch of numbers read from Filename ("-" is stdin), one per
+// line. Candidates are screened in batches against the primorial of the
+// primes up to PrimeBound with a remainder tree, and only the ones
+// without a small factor get the full probable-prime test.
+int32_t IsPrimeBatch(const char* Filename) {
+  std::ifstream IFS;
+  std::istream* IS = &std::cin;
 
-  mpz_set_ui(ON, 1UL);
-  mpz_sqrt(SQRT, X);
-  mpz_add(SQRT, ON, SQRT);
+  if (std::strcmp(Filename, "-") != 0) {
+    IFS.open(Filename);
+    if (!IFS.is_open()) {
+      std::cerr << "Error: Unable to open file '" << Filename
+        << "' for reading!" << std::endl;
+      return 1;
+    }
 
-  mpz_t I;
-  mpz_t D;
-  mpz_t R;
-  mpz_t T;
-  mpz_t Z;
+    IS = &IFS;
+  }
 
-  mpz_init2(I, Bits);
-  mpz_init2(D, Bits);
-  mpz_init2(R, Bits);
-  mpz_init2(T, Bits);
-  mpz_init2(Z, Bits);
+  // Batch screening only pays for itself once the probable-prime test
+  // gets expensive: below 512 bits it costs more than it saves.
+  if (PrimeBound == static_cast<uint32_t>(~0x0))
+    PrimeBound = Bits < 512U ? 0U : Bits <= 1024U ? 16384U : 65536U;
 
-  mpz_set_ui(I, 3UL);
-  mpz_set_ui(T, 2UL);
-  mpz_set_ui(Z, 0UL);
+  mpz_t SP;
+  mpz_init(SP);
 
-  while (mpz_cmp(SQRT, I) > 0) {
-    mpz_mod(R, X, I);
+  if (PrimeBound) {
+    std::vector<uint32_t> Primes;
+    SievePrimes(PrimeBound, Primes);
+    Primorial(SP, Primes);
+  }
 
-    if (mpz_cmpabs(R, Z) == 0) {
-      NP = true;
-      break;
+  std::vector<std::string> Lines;
+  std::vector<bool> Trivial;
+  mpz_t* X = new mpz_t[BatchSize];
+  mpz_t* G = new mpz_t[BatchSize];
+  ProductTree T;
+
+  for (size_t I = 0UL; I < BatchSize; ++I) {
+    mpz_init2(X[I], Bits);
+    mpz_init2(G[I], Bits);
+  }
+
+  std::string L;
+  bool Done = false;
+
+  while (!Done) {
+    size_t N = 0UL;
+    Lines.clear();
+    Trivial.clear();
+
+    while (N < BatchSize) {
+      if (!std::getline(*IS, L)) {
+        Done = true;
+        break;
+      }
+
+      size_t B = L.find_first_not_of(" \t\r");
+      size_t E = L.find_last_not_of(" \t\r");
+      if (B == std::string::npos)
+        continue;
+
+      L = L.substr(B, E - B + 1);
+
+      if (mpz_set_str(X[N], L.c_str(), 10) != 0 || mpz_sgn(X[N]) < 0) {
+        std::cerr << "Error: " << L << " is not an unsigned integer!"
+          << std::endl;
+        continue;
+      }
+
+      // 0 and 1 are not prime, and a 0 leaf would zero the product tree.
+      Trivial.push_back(mpz_cmp_ui(X[N], 1UL) <= 0);
+      if (Trivial.back())
+        mpz_set_ui(X[N], 1UL);
+
+      Lines.push_back(L);
+      ++N;
     }
 
-    mpz_add(I, T, I);
+    if (PrimeBound)
+      BatchSmallFactors(T, X, N, SP, G);
+
+    for (size_t I = 0UL; I < N; ++I) {
+      if (Trivial[I])
+        (void) NotPrime(Lines[I].c_str());
+      else if (PrimeBound && mpz_cmp_ui(G[I], 1UL) != 0 &&
+          mpz_cmp(G[I], X[I]) != 0)
+        (void) NotPrime(Lines[I].c_str());
+      else if (IsProbablePrimeMP(X[I], Bits))
+        (void) Prime(Lines[I].c_str());
+      else
+        (void) NotPrime(Lines[I].c_str());
+    }
   }
 
-  mpz_clear(Z);
-  mpz_clear(T);
-  mpz_clear(R);
-  mpz_clear(D);
-  mpz_clear(I);
-  mpz_clear(ON);
-  mpz_clear(SQRT);
-  mpz_clear(X);
+  for (size_t I = 0UL; I < BatchSize; ++I) {
+    mpz_clear(X[I]);
+    mpz_clear(G[I]);
+  }
 
-  return NP ? NotPrime(argv) : Prime(argv);
+  delete [] X;
+  delete [] G;
+  mpz_clear(SP);
+
+  return 0;
+}
+
+// 2^E mod Q, for odd Q < 2^64.
+static uint64_t PowTwoMod(uint64_t E, uint64_t Q) {
+  uint128_t R = 1U;
+  uint128_t B = 2U % Q;
+
+  while (E) {
+    if (E & 1UL)
+      R = R * B % Q;
+
+    B = B * B % Q;
+    E >>= 1;
+  }
+
+  return (uint64_t) R;
+}
+
+static bool IsSmallPrimeUI(uint64_t X) {
+  if (X < 2UL)
+    return false;
+
+  if (X < 4UL)
+    return true;
+
+  if (!(X & 1UL))
+    return false;
+
+  for (uint64_t I = 3UL; I * I <= X; I += 2UL) {
+    if (X % I == 0UL)
+      return false;
+  }
+
+  return true;
+}
+
+// Looks for a factor q < 2^FB of 2^P - 1. Every such factor has the form
+// q = 2kP + 1 with q = +/-1 mod 8, so only those are tried, after a
+// cheap filter by the primes up to 23. Returns 0 if none was found.
+static uint64_t MersenneTrialFactor(uint64_t P, uint32_t FB) {
+  static const uint64_t SP[] = { 3, 5, 7, 11, 13, 17, 19, 23 };
+  uint64_t KMax = ((FB >= 64U ? ~0UL : (1UL << FB)) - 1UL) / (2UL * P);
+
+  for (uint64_t K = 1UL; K <= KMax; ++K) {
+    uint64_t Q = 2UL * K * P + 1UL;
+
+    if ((Q & 7UL) != 1UL && (Q & 7UL) != 7UL)
+      continue;
+
+    bool C = false;
+    for (size_t I = 0UL; I < sizeof(SP) / sizeof(SP[0]); ++I) {
+      if (Q % SP[I] == 0UL && Q != SP[I]) {
+        C = true;
+        break;
+      }
+    }
+
+    if (!C && PowTwoMod(P, Q) == 1UL)
+      return Q;
+  }
+
+  return 0UL;
+}
+
+// Lucas-Lehmer test of M = 2^P - 1. S(0) = 4, S(i + 1) = S(i)^2 - 2 mod M,
+// and M is prime iff S(P - 2) = 0. The square is reduced by folding: for
+// S^2 = H * 2^P + L, S^2 = H + L mod M.
+int32_t IsMersennePrime(uint64_t P) {
+  std::string Name = "2^" + std::to_string(P) + "-1";
+
+  if (P == 2UL)
+    return Prime(Name.c_str());
+
+  if (!IsSmallPrimeUI(P)) {
+    std::cerr << Name << " is not prime (" << P << " is not prime)."
+      << std::endl;
+    return 0;
+  }
+
+  // Trial factoring to ~2^24 candidates k unless -F says otherwise;
+  // there is no point in going past sqrt(M).
+  uint32_t FB = FactorBits;
+  if (FB == 0U)
+    FB = 64U - (uint32_t) __builtin_clzl(P) + 25U;
+  if (FB > 64U)
+    FB = 64U;
+  if (FB > P / 2UL + 1UL)
+    FB = (uint32_t) (P / 2UL + 1UL);
+
+  uint64_t Q = MersenneTrialFactor(P, FB);
+  if (Q) {
+    std::cerr << Name << " is not prime (factor " << Q << ")." << std::endl;
+    return 0;
+  }
+
+  mpz_t M;
+  mpz_t S;
+  mpz_t H;
+
+  mpz_init2(M, P + 1);
+  mpz_init2(S, 2 * P + 64);
+  mpz_init2(H, P + 64);
+
+  mpz_setbit(M, P);
+  mpz_sub_ui(M, M, 1UL);
+  mpz_set_ui(S, 4UL);
+
+  for (uint64_t I = 0UL; I < P - 2UL; ++I) {
+    mpz_mul(S, S, S);
+
+    mpz_tdiv_q_2exp(H, S, P);
+    mpz_tdiv_r_2exp(S, S, P);
+    mpz_add(S, S, H);
+
+    if (mpz_cmp(S, M) >= 0)
+      mpz_sub(S, S, M);
+
+    if (mpz_cmp_ui(S, 2UL) < 0)
+      mpz_add(S, S, M);
+
+    mpz_sub_ui(S, S, 2UL);
+  }
+
+  bool R = mpz_sgn(S) == 0 || mpz_cmp(S, M) == 0;
+
+  mpz_clear(H);
+  mpz_clear(S);
+  mpz_clear(M);
+
+  return R ? Prime(Name.c_str()) : NotPrime(Name.c_str());
+}
+
+// K * 2^N + 1 by Proth's theorem, falling back to the probable-prime
+// test when the theorem does not apply.
+int32_t IsProthPrime(uint64_t K, uint64_t N) {
+  std::string Name = std::to_string(K) + "*2^" + std::to_string(N) + "+1";
+
+  proth_result R = ProthTest(K, N);
+
+  if (R == ProthUnknown) {
+    mpz_t X;
+    mpz_init_set_ui(X, K);
+    mpz_mul_2exp(X, X, N);
+    mpz_add_ui(X, X, 1UL);
+    R = IsProbablePrimeMP(X, (uint32_t) mpz_sizeinbase(X, 2)) ?
+      ProthPrime : ProthComposite;
+    mpz_clear(X);
+  }
+
+  return R == ProthPrime ? Prime(Name.c_str()) : NotPrime(Name.c_str());
+}
+
+int32_t IsFermatPrime(uint32_t M) {
+  std::string Name = "2^(2^" + std::to_string(M) + ")+1";
+  return PepinTest(M) ? Prime(Name.c_str()) : NotPrime(Name.c_str());
 }
 
 static void PrintUsage() {
   std::cerr << "Usage: isprimemp -b <number-of-bits> <unsigned integer>"
     << std::endl;
+  std::cerr << "       isprimemp -b <number-of-bits> -f <input-file | - (stdin)>"
+    << std::endl;
+  std::cerr << "                 [ -B <small-prime-bound> (default by size, "
+    << "0 = off)]" << std::endl;
+  std::cerr << "       isprimemp -M <p> (Lucas-Lehmer test of 2^p-1)"
+    << std::endl;
+  std::cerr << "                 [ -F <trial-factor-bits> (default by p)]"
+    << std::endl;
+  std::cerr << "       isprimemp -k <k> -n <n> (Proth test of k*2^n+1)"
+    << std::endl;
+  std::cerr << "       isprimemp -e <m> (Pepin test of 2^(2^m)+1)" << std::endl;
 }
 
 int main(int argc, char* const argv[])
 {
-  if (argc != 4) {
+  if (argc < 3) {
     PrintUsage();
     return 1;
   }
 
   int opt;
+  const char* Filename = NULL;
+  uint64_t MersenneP = 0UL;
+  uint64_t ProthK = 0UL;
+  uint64_t ProthN = 0UL;
+  int64_t FermatM = -1L;
 
-  while ((opt = getopt(argc, argv, "hb:")) != -1) {
+  while ((opt = getopt(argc, argv, "hb:f:B:M:F:k:n:e:")) != -1) {
     switch (opt) {
     case 'b':
       Bits = (int32_t) std::stoul(optarg);
       break;
+    case 'f':
+      Filename = optarg;
+      break;
+    case 'B':
+      PrimeBound = (uint32_t) std::stoul(optarg);
+      break;
+    case 'M':
+      MersenneP = (uint64_t) std::stoull(optarg);
+      break;
+    case 'F':
+      FactorBits = (uint32_t) std::stoul(optarg);
+      break;
+    case 'k':
+      ProthK = (uint64_t) std::stoull(optarg);
+      break;
+    case 'n':
+      ProthN = (uint64_t) std::stoull(optarg);
+      break;
+    case 'e':
+      FermatM = (int64_t) std::stoll(optarg);
+      break;
     case 'h':
       PrintUsage();
       return 0;
@@ -138,11 +404,48 @@ int main(int argc, char* const argv[])
     }
   }
 
+  if (MersenneP) {
+    if (MersenneP < 2UL || MersenneP > 0xffffffffUL) {
+      std::cerr << "Error: The Mersenne exponent must be in [2, 2^32)!"
+        << std::endl;
+      return 1;
+    }
+
+    return IsMersennePrime(MersenneP);
+  }
+
+  if (FermatM >= 0L) {
+    if (FermatM > 40L) {
+      std::cerr << "Error: The Fermat index must be <= 40!" << std::endl;
+      return 1;
+    }
+
+    return IsFermatPrime((uint32_t) FermatM);
+  }
+
+  if (ProthK || ProthN) {
+    if (ProthK == 0UL || ProthN == 0UL || ProthN > 0xffffffffUL) {
+      std::cerr << "Error: Proth mode needs k > 0 and 0 < n < 2^32!"
+        << std::endl;
+      return 1;
+    }
+
+    return IsProthPrime(ProthK, ProthN);
+  }
+
   if (Bits == static_cast<unsigned>(~0x0) || Bits < 32U) {
     std::cerr << "Error: Invalid number of bits!" << std::endl;
     return 1;
   }
 
+  if (Filename)
+    return IsPrimeBatch(Filename);
+
+  if (optind != argc - 1) {
+    PrintUsage();
+    return 1;
+  }
+
   size_t SL = std::strlen(argv[argc - 1]);
 
   if (SL == 1)
@@ -16,19 +16,31 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <iomanip>
 #include <string>
-#include <set>
+#include <vector>
 #include <map>
+#include <algorithm>
+#include <charconv>
 #include <cmath>
 #include <cstring>
 #include <ctime>
 #include <cerrno>
 
-static std::multiset<uint64_t> Factors;
-static std::map<uint64_t, uint32_t> FM;
+#include <unistd.h>
+
+#include "smallprimes.h"
+#include "batch.h"
+#include "spftable.h"
+#include "uint128.h"
+
+static std::map<uint128_t, uint32_t> FM;
 static bool Check = false;
 
+// -S: odd numbers below SPF.Limit are factored by table lookups.
+static SPFTable SPF;
+
 static struct timespec tp_start;
 static struct timespec tp_end;
 
@@ -63,95 +75,901 @@ static void PrintTimediff(const struct timespec* start,
     << nns << " second(s)." << std::endl;
 }
 
-static inline bool IsPrime(uint64_t N)
+// Montgomery arithmetic modulo an odd 64-bit N, with R = 2^64.
+struct montgomery64 {
+  explicit montgomery64(uint64_t n) : N(n), NInv(n), One(0UL), R2(0UL) {
+    // Newton's iteration doubles the correct low bits of N^-1 mod 2^64
+    // every step; N itself is correct to 3 bits.
+    for (unsigned I = 0U; I < 5U; ++I)
+      NInv *= 2UL - N * NInv;
+
+    One = (uint64_t) ((((uint128_t) 1U) << 64) % N);
+    R2 = (uint64_t) ((uint128_t) One * One % N);
+  }
+
+  // T * R^-1 mod N, for T < N * 2^64.
+  inline uint64_t Reduce(uint128_t T) const {
+    uint64_t M = (uint64_t) T * NInv;
+    uint64_t H = (uint64_t) (((uint128_t) M * N) >> 64);
+    uint64_t TH = (uint64_t) (T >> 64);
+
+    return TH >= H ? TH - H : TH - H + N;
+  }
+
+  inline uint64_t Mul(uint64_t A, uint64_t B) const {
+    return Reduce((uint128_t) A * B);
+  }
+
+  inline uint64_t ToMont(uint64_t A) const {
+    return Mul(A % N, R2);
+  }
+
+  inline uint64_t FromMont(uint64_t A) const {
+    return Reduce(A);
+  }
+
+  inline uint64_t Add(uint64_t A, uint64_t B) const {
+    uint64_t S = A + B;
+    return (S < A || S >= N) ? S - N : S;
+  }
+
+  inline uint64_t Sub(uint64_t A, uint64_t B) const {
+    return A >= B ? A - B : A - B + N;
+  }
+
+  uint64_t Pow(uint64_t A, uint64_t E) const {
+    uint64_t R = One;
+
+    while (E) {
+      if (E & 1UL)
+        R = Mul(R, A);
+
+      A = Mul(A, A);
+      E >>= 1;
+    }
+
+    return R;
+  }
+
+  uint64_t N;
+  uint64_t NInv;
+  uint64_t One;
+  uint64_t R2;
+};
+
+static uint64_t GCD(uint64_t A, uint64_t B) {
+  while (B) {
+    uint64_t T = A % B;
+    A = B;
+    B = T;
+  }
+
+  return A;
+}
+
+// Deterministic Miller-Rabin: the first twelve primes as bases are
+// sufficient for every N < 2^64.
+static bool IsPrime(uint64_t N)
 {
-  if (N == 0UL)
+  static const uint64_t Bases[] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37
+  };
+
+  if (N < 2UL)
     return false;
 
-  if (N <= 2UL)
+  for (size_t I = 0UL; I < sizeof(Bases) / sizeof(Bases[0]); ++I) {
+    if (N % Bases[I] == 0UL)
+      return N == Bases[I];
+  }
+
+  if (N < 37UL * 37UL)
     return true;
 
-  if ((N & 1ULL) == 0)
-    return false;
+  montgomery64 M(N);
+  uint64_t D = N - 1UL;
+  unsigned S = (unsigned) __builtin_ctzl(D);
+  D >>= S;
+
+  uint64_t MinusOne = M.Sub(0UL, M.One);
+
+  for (size_t I = 0UL; I < sizeof(Bases) / sizeof(Bases[0]); ++I) {
+    uint64_t X = M.Pow(M.ToMont(Bases[I]), D);
 
-  uint64_t SQR = static_cast<uint64_t>(std::sqrt(N) + 1ULL);
+    if (X == M.One || X == MinusOne)
+      continue;
 
-  for (uint64_t I = 3UL; I <= SQR; I += 2UL) {
-    if ((static_cast<uint64_t>(N % I)) == 0UL)
+    bool Composite = true;
+    for (unsigned J = 1U; J < S; ++J) {
+      X = M.Mul(X, X);
+
+      if (X == MinusOne) {
+        Composite = false;
+        break;
+      }
+    }
+
+    if (Composite)
       return false;
   }
 
   return true;
 }
 
-static void PrimeFactors(uint64_t N) {
-  uint64_t NX = N;
+// Brent's variant of Pollard's rho, x -> x^2 + C, in Montgomery form.
+// The differences are multiplied together and a gcd is only taken every
+// BatchSteps steps; if a batch overshoots to gcd = N it is replayed one
+// step at a time from the saved position. Returns a proper factor of the
+// odd composite N, or N if this C failed.
+static uint64_t PollardBrent(uint64_t N, uint64_t C) {
+  static const uint64_t BatchSteps = 128UL;
+
+  montgomery64 M(N);
+  uint64_t MC = M.ToMont(C);
+  uint64_t Y = M.ToMont(2UL);
+  uint64_t X = Y;
+  uint64_t YS = Y;
+  uint64_t Q = M.One;
+  uint64_t G = 1UL;
+
+  for (uint64_t R = 1UL; G == 1UL; R <<= 1) {
+    X = Y;
+
+    for (uint64_t I = 0UL; I < R; ++I)
+      Y = M.Add(M.Mul(Y, Y), MC);
 
-  while ((NX % 2) == 0) {
-    Factors.insert(2);
-    NX /= 2;
+    for (uint64_t K = 0UL; K < R && G == 1UL; K += BatchSteps) {
+      YS = Y;
+
+      uint64_t L = R - K < BatchSteps ? R - K : BatchSteps;
+      for (uint64_t I = 0UL; I < L; ++I) {
+        Y = M.Add(M.Mul(Y, Y), MC);
+        Q = M.Mul(Q, M.Sub(X, Y));
+      }
+
+      G = GCD(Q, N);
+    }
+  }
+
+  if (G == N) {
+    do {
+      YS = M.Add(M.Mul(YS, YS), MC);
+      G = GCD(M.Sub(X, YS), N);
+    } while (G == 1UL);
   }
 
-  uint64_t S = (uint64_t) std::sqrt(N);
+  return G;
+}
+
+// Splits N until every part is prime.
+static void SplitFactors(uint64_t N, std::vector<uint64_t>& Factors) {
+  if (N == 1UL)
+    return;
 
-  for (uint64_t I = 3; I <= S; I += 2) {
-    while ((N % I) == 0) {
-      Factors.insert(I);
-      N /= I;
+  if (IsPrime(N)) {
+    Factors.push_back(N);
+    return;
+  }
+
+  uint64_t D = N;
+  for (uint64_t C = 1UL; D == N; ++C)
+    D = PollardBrent(N, C);
+
+  SplitFactors(D, Factors);
+  SplitFactors(N / D, Factors);
+}
+
+// Trial division by the small primes takes out the small factors
+// cheaply; what is left has only factors above SmallPrimeLimit and goes
+// to the primality test and Pollard-Brent rho. The prime factors of N
+// are appended to Factors with multiplicity, in ascending order.
+static void PrimeFactors(uint64_t N, std::vector<uint64_t>& Factors) {
+  if (N < 2UL)
+    return;
+
+  size_t B = Factors.size();
+
+  while ((N & 1UL) == 0UL) {
+    Factors.push_back(2UL);
+    N >>= 1;
+  }
+
+  if (SPF.Covers(N)) {
+    SPF.Factor(N, [&Factors](uint64_t P) {
+      Factors.push_back(P);
+    });
+    return;
+  }
+
+  N = StripSmallPrimes(N, [&Factors](uint64_t P, uint32_t E) {
+    Factors.insert(Factors.end(), E, P);
+  });
+
+  SplitFactors(N, Factors);
+  std::sort(Factors.begin() + B, Factors.end());
+}
+
+// Numbers above 64 bits are split with 128-bit Miller-Rabin and rho
+// until the parts fit in 64 bits.
+static void SplitFactors128(uint128_t N, std::vector<uint128_t>& Factors) {
+  if ((N >> 64) == 0U) {
+    std::vector<uint64_t> F;
+    SplitFactors((uint64_t) N, F);
+    Factors.insert(Factors.end(), F.begin(), F.end());
+    return;
+  }
+
+  if (IsPrime128(N)) {
+    Factors.push_back(N);
+    return;
+  }
+
+  uint128_t D = N;
+  for (uint128_t C = 1U; D == N; ++C)
+    D = PollardBrent128(N, C);
+
+  SplitFactors128(D, Factors);
+  SplitFactors128(N / D, Factors);
+}
+
+// The factors of N < 2^128. The small primes come out through one
+// 128 by 64-bit remainder per group of the small prime table; as soon as
+// the cofactor fits in 64 bits, the 64-bit code takes over.
+static void PrimeFactors128(uint128_t N, std::vector<uint128_t>& Factors) {
+  size_t B = Factors.size();
+  std::vector<uint64_t> F;
+
+  if ((N >> 64) != 0U) {
+    unsigned Z = Ctz128(N);
+    Factors.insert(Factors.end(), Z, 2U);
+    N >>= Z;
+  }
+
+  for (size_t GI = 0UL; GI < SmallPrimeGroupCount && (N >> 64) != 0U;
+       ++GI) {
+    const small_prime_group& G = SmallPrimeGroups[GI];
+    uint64_t GR = (uint64_t) (N % G.Product);
+
+    for (uint32_t J = G.Begin; J < G.End; ++J) {
+      if (!DividesSmall(SmallPrimeTable[J], GR))
+        continue;
+
+      uint64_t P = SmallPrimeTable[J].P;
+      while (N % P == 0U) {
+        Factors.push_back(P);
+        N /= P;
+      }
     }
   }
 
-  if (N > 2 && IsPrime(N))
-    Factors.insert(N);
-  if (NX > 2 && IsPrime(NX))
-    Factors.insert(NX);
+  if ((N >> 64) == 0U) {
+    PrimeFactors((uint64_t) N, F);
+    Factors.insert(Factors.end(), F.begin(), F.end());
+  } else {
+    SplitFactors128(N, Factors);
+  }
+
+  std::sort(Factors.begin() + B, Factors.end());
+}
+
+static inline void AppendNumber(std::string& Out, uint64_t V) {
+  char B[24];
+  std::to_chars_result R = std::to_chars(B, B + sizeof(B), V);
+  Out.append(B, R.ptr);
+}
+
+static inline void AppendNumber(std::string& Out, uint128_t V) {
+  char B[UINT128_MAX_DIGITS];
+  Out.append(B, FormatUInt128(B, V));
+}
+
+// One line of batch output: N followed by a p^e token for every prime
+// factor, ascending.
+template<typename T>
+static void FormatFactors(T N, const std::vector<T>& Factors,
+                          std::string& Out) {
+  Out.clear();
+  AppendNumber(Out, N);
+
+  for (size_t I = 0UL; I < Factors.size(); ) {
+    size_t J = I;
+    while (J < Factors.size() && Factors[J] == Factors[I])
+      ++J;
+
+    Out += ' ';
+    AppendNumber(Out, Factors[I]);
+    Out += '^';
+    AppendNumber(Out, (uint64_t) (J - I));
+    I = J;
+  }
+}
+
+// Per-thread state of the batch mode.
+struct factor_worker {
+  factor_worker() : Factors(), Factors128() {
+    Factors.reserve(64UL);
+  }
+
+  void operator()(const std::string& In, std::string& Out) {
+    const char* B = In.data();
+    const char* E = B + In.size();
+
+    while (B < E && (*B == ' ' || *B == '\t'))
+      ++B;
+    while (E > B && (E[-1] == ' ' || E[-1] == '\t' || E[-1] == '\r'))
+      --E;
+
+    uint64_t N;
+    uint128_t N128;
+    std::from_chars_result R = std::from_chars(B, E, N);
+
+    if (B != E && R.ec == std::errc() && R.ptr == E) {
+      Factors.clear();
+      PrimeFactors(N, Factors);
+      FormatFactors(N, Factors, Out);
+    } else if (R.ec == std::errc::result_out_of_range &&
+               ParseUInt128(B, E, &N128)) {
+      Factors128.clear();
+      PrimeFactors128(N128, Factors128);
+      FormatFactors(N128, Factors128, Out);
+    } else {
+      Out.assign(B, E);
+      Out += " invalid";
+    }
+  }
+
+  std::vector<uint64_t> Factors;
+  std::vector<uint128_t> Factors128;
+};
+
+static std::string ToDecimal(uint128_t V) {
+  std::string S;
+  AppendNumber(S, V);
+  return S;
 }
 
 static void CheckFactors() {
   std::cout << "----------------------------" << std::endl;
-  for (std::map<uint64_t, uint32_t>::const_iterator I = FM.begin();
+  for (std::map<uint128_t, uint32_t>::const_iterator I = FM.begin();
        I != FM.end(); ++I) {
-    if (IsPrime((*I).first))
-      std::cout << (*I).first << " is prime." << std::endl;
+    uint128_t P = (*I).first;
+
+    if ((P >> 64) ? IsPrime128(P) : IsPrime((uint64_t) P))
+      std::cout << ToDecimal(P) << " is prime." << std::endl;
     else
-      std::cout << (*I).first << " is NOT prime." << std::endl;
+      std::cout << ToDecimal(P) << " is NOT prime." << std::endl;
   }
   std::cout << "----------------------------" << std::endl;
 }
 
+// Range mode: a segmented sieve records the prime factors up to
+// RangeSieveLimit of every number in a segment with their multiplicities,
+// so each number costs one exact division per prime power dividing it,
+// O(log log n) on average. Whatever is left of a number is 1, a prime,
+// or (only above RangeSieveLimit^2) a product of large primes for rho.
+
+static const uint64_t RangeSegment = 1UL << 17;
+static const uint32_t RangeSieveLimit = 1U << 21;
+
+// The product of the 16 smallest primes exceeds 2^64.
+static const uint32_t RangeMaxDistinct = 15U;
+
+// Arithmetic functions for -m, in output column order.
+enum range_function {
+  RangePhi = 1U,
+  RangeSigma = 2U,
+  RangeTau = 4U,
+  RangeMu = 8U,
+  RangeOmega = 16U
+};
+
+static const char* const RangeFunctionNames[] = {
+  "phi", "sigma", "tau", "mu", "omega"
+};
+
+struct range_job {
+  range_job() : A(0UL), B(0UL), Limit(0U), Functions(0U), Binary(false),
+    Primes(), Inv(), Segments(0UL), Next(0UL), Written(0UL), Out(NULL) {
+    (void) pthread_mutex_init(&Mutex, NULL);
+    (void) pthread_cond_init(&Turn, NULL);
+  }
+
+  ~range_job() {
+    (void) pthread_cond_destroy(&Turn);
+    (void) pthread_mutex_destroy(&Mutex);
+  }
+
+  uint64_t A;
+  uint64_t B;
+  uint64_t Limit;
+
+  // Mask of range_function's; 0 writes the factorizations.
+  uint32_t Functions;
+  bool Binary;
+
+  // The odd primes up to Limit and their inverses mod 2^64.
+  std::vector<uint32_t> Primes;
+  std::vector<uint64_t> Inv;
+
+  uint64_t Segments;
+  std::atomic<uint64_t> Next;
+
+  // Segments are written in order: the one numbered Written goes next.
+  uint64_t Written;
+  pthread_mutex_t Mutex;
+  pthread_cond_t Turn;
+  std::FILE* Out;
+};
+
+// Odd-only sieve of Eratosthenes: the odd primes <= Limit.
+static void SieveOddPrimes(uint32_t Limit, std::vector<uint32_t>& Primes) {
+  Primes.clear();
+
+  // Index I stands for 2 * I + 1.
+  size_t S = (size_t) Limit / 2UL + 1UL;
+  std::vector<bool> C(S, false);
+
+  for (size_t I = 1UL; I < S; ++I) {
+    if (C[I])
+      continue;
+
+    size_t P = 2UL * I + 1UL;
+    if (P > Limit)
+      break;
+
+    Primes.push_back((uint32_t) P);
+
+    for (size_t J = P * P / 2UL; J < S; J += P)
+      C[J] = true;
+  }
+}
+
+// One thread's segment storage.
+class RangeSieve {
+public:
+  explicit RangeSieve(range_job& J) : Job(J), Rem(RangeSegment),
+    Count(RangeSegment), P(RangeSegment * RangeMaxDistinct),
+    E(RangeSegment * RangeMaxDistinct), Large(), Text() { }
+
+  void Run() {
+    for (;;) {
+      uint64_t K = Job.Next.fetch_add(1UL, std::memory_order_relaxed);
+      if (K >= Job.Segments)
+        break;
+
+      uint64_t L = Job.A + K * RangeSegment;
+      uint64_t N = Job.B - L < RangeSegment - 1UL ? Job.B - L + 1UL :
+        RangeSegment;
+
+      Sieve(L, N);
+      Format(L, N);
+
+      pthread_mutex_lock(&Job.Mutex);
+      while (Job.Written != K)
+        pthread_cond_wait(&Job.Turn, &Job.Mutex);
+
+      (void) std::fwrite(Text.data(), 1UL, Text.size(), Job.Out);
+      ++Job.Written;
+      pthread_cond_broadcast(&Job.Turn);
+      pthread_mutex_unlock(&Job.Mutex);
+    }
+  }
+
+private:
+  RangeSieve(const RangeSieve&) = delete;
+  RangeSieve& operator=(const RangeSieve&) = delete;
+
+  inline void Record(size_t I, uint32_t Q, uint8_t X) {
+    size_t C = Count[I]++;
+    P[I * RangeMaxDistinct + C] = Q;
+    E[I * RangeMaxDistinct + C] = X;
+  }
+
+  // The numbers L .. L + N - 1, L >= 1.
+  void Sieve(uint64_t L, uint64_t N) {
+    uint64_t H = L + (N - 1UL);
+
+    for (size_t I = 0UL; I < N; ++I) {
+      Rem[I] = L + I;
+      Count[I] = 0U;
+    }
+
+    for (size_t I = L & 1UL; I < N; I += 2UL) {
+      unsigned Z = (unsigned) __builtin_ctzl(Rem[I]);
+      Rem[I] >>= Z;
+      Record(I, 2U, (uint8_t) Z);
+    }
+
+    for (size_t K = 0UL; K < Job.Primes.size(); ++K) {
+      uint64_t Q = Job.Primes[K];
+      if (Q > H)
+        break;
+
+      uint64_t QI = Job.Inv[K];
+      uint64_t R = L % Q;
+      size_t I0 = R ? (size_t) (Q - R) : 0UL;
+
+      for (size_t I = I0; I < N; I += Q) {
+        Rem[I] *= QI;
+        Record(I, (uint32_t) Q, 1U);
+      }
+
+      // Every multiple of Q^j, j >= 2, has Q as its last recorded prime.
+      for (uint64_t QJ = Q; QJ <= H / Q; ) {
+        QJ *= Q;
+        R = L % QJ;
+
+        for (uint64_t I = R ? QJ - R : 0UL; I < N; I += QJ) {
+          Rem[I] *= QI;
+          ++E[I * RangeMaxDistinct + Count[I] - 1U];
+        }
+      }
+    }
+  }
+
+  // Calls F(p, e) for the prime factors of L + I in increasing order.
+  template<typename Fn>
+  inline void ForEachFactor(size_t I, Fn F) {
+    for (size_t C = 0UL; C < Count[I]; ++C)
+      F((uint64_t) P[I * RangeMaxDistinct + C],
+        (unsigned) E[I * RangeMaxDistinct + C]);
+
+    // The cofactor has no prime factor up to Limit.
+    uint64_t R = Rem[I];
+    if (R == 1UL)
+      return;
+
+    if (R / Job.Limit < Job.Limit || IsPrime(R)) {
+      F(R, 1U);
+      return;
+    }
+
+    Large.clear();
+    SplitFactors(R, Large);
+    std::sort(Large.begin(), Large.end());
+
+    for (size_t J = 0UL; J < Large.size(); ) {
+      size_t K = J;
+      while (K < Large.size() && Large[K] == Large[J])
+        ++K;
+
+      F(Large[J], (unsigned) (K - J));
+      J = K;
+    }
+  }
+
+  void Format(uint64_t L, uint64_t N) {
+    Text.clear();
+
+    if (Job.Functions) {
+      FormatFunctions(L, N);
+      return;
+    }
+
+    char B[24];
+
+    for (size_t I = 0UL; I < N; ++I) {
+      std::to_chars_result TR = std::to_chars(B, B + sizeof(B), L + I);
+      Text.append(B, TR.ptr);
+
+      ForEachFactor(I, [&](uint64_t Q, unsigned X) {
+        Text += ' ';
+        TR = std::to_chars(B, B + sizeof(B), Q);
+        Text.append(B, TR.ptr);
+        Text += '^';
+        TR = std::to_chars(B, B + sizeof(B), X);
+        Text.append(B, TR.ptr);
+      });
+
+      Text += '\n';
+    }
+  }
+
+  inline void AppendDecimal(uint64_t V) {
+    char B[24];
+    std::to_chars_result TR = std::to_chars(B, B + sizeof(B), V);
+    Text.append(B, TR.ptr);
+  }
+
+  inline void AppendDecimal(uint128_t V) {
+    static const uint64_t D19 = 10000000000000000000UL;
+
+    if ((V >> 64) == 0U) {
+      AppendDecimal((uint64_t) V);
+      return;
+    }
+
+    // sigma(n) < 2^64 * 10^19 for every 64-bit n.
+    char B[24];
+    AppendDecimal((uint64_t) (V / D19));
+    std::to_chars_result TR = std::to_chars(B, B + sizeof(B),
+                                            (uint64_t) (V % D19));
+    Text.append(19UL - (size_t) (TR.ptr - B), '0');
+    Text.append(B, TR.ptr);
+  }
+
+  template<typename T>
+  inline void AppendBinary(T V) {
+    char B[sizeof(T)];
+    std::memcpy(B, &V, sizeof(T));
+    Text.append(B, sizeof(T));
+  }
+
+  void FormatFunctions(uint64_t L, uint64_t N) {
+    const uint32_t Fn = Job.Functions;
+
+    for (size_t I = 0UL; I < N; ++I) {
+      uint64_t Phi = 1UL;
+      uint128_t Sigma = 1U;
+      uint32_t Tau = 1U;
+      int8_t Mu = 1;
+      uint8_t Omega = 0U;
+
+      ForEachFactor(I, [&](uint64_t Q, unsigned X) {
+        ++Omega;
+
+        if (Fn & RangePhi) {
+          Phi *= Q - 1UL;
+          for (unsigned K = 1U; K < X; ++K)
+            Phi *= Q;
+        }
+
+        if (Fn & RangeSigma) {
+          // 1 + Q + ... + Q^X.
+          uint128_t S = 1U;
+          uint128_t QK = 1U;
+          for (unsigned K = 0U; K < X; ++K) {
+            QK *= Q;
+            S += QK;
+          }
+          Sigma *= S;
+        }
+
+        Tau *= X + 1U;
+        Mu = X > 1U ? 0 : (int8_t) -Mu;
+      });
+
+      if (Job.Binary) {
+        if (Fn & RangePhi)
+          AppendBinary(Phi);
+        if (Fn & RangeSigma)
+          AppendBinary(Sigma);
+        if (Fn & RangeTau)
+          AppendBinary(Tau);
+        if (Fn & RangeMu)
+          AppendBinary(Mu);
+        if (Fn & RangeOmega)
+          AppendBinary(Omega);
+        continue;
+      }
+
+      AppendDecimal(L + I);
+      if (Fn & RangePhi) {
+        Text += ',';
+        AppendDecimal(Phi);
+      }
+      if (Fn & RangeSigma) {
+        Text += ',';
+        AppendDecimal(Sigma);
+      }
+      if (Fn & RangeTau) {
+        Text += ',';
+        AppendDecimal((uint64_t) Tau);
+      }
+      if (Fn & RangeMu) {
+        Text += ',';
+        if (Mu < 0)
+          Text += '-';
+        AppendDecimal((uint64_t) (Mu != 0));
+      }
+      if (Fn & RangeOmega) {
+        Text += ',';
+        AppendDecimal((uint64_t) Omega);
+      }
+      Text += '\n';
+    }
+  }
+
+  range_job& Job;
+  std::vector<uint64_t> Rem;
+  std::vector<uint8_t> Count;
+  std::vector<uint32_t> P;
+  std::vector<uint8_t> E;
+  std::vector<uint64_t> Large;
+  std::string Text;
+};
+
+extern "C" {
+  static void* range_thread_start(void* Arg) {
+    RangeSieve S(*static_cast<range_job*>(Arg));
+    S.Run();
+    return NULL;
+  }
+}
+
+// Factors every integer of [A, B] and writes the batch mode lines, or
+// the arithmetic functions in Functions as CSV or binary records.
+static int RangeFactors(uint64_t A, uint64_t B, uint32_t Threads,
+                        uint32_t Functions, bool Binary) {
+  range_job Job;
+  Job.Out = stdout;
+  Job.Functions = Functions;
+  Job.Binary = Binary;
+
+  if (Functions) {
+    if (A == 0UL) {
+      std::cerr << "Error: The functions are not defined at 0!" << std::endl;
+      return 1;
+    }
+
+    if (!Binary) {
+      (void) std::fputs("n", stdout);
+      for (uint32_t I = 0U; I < 5U; ++I) {
+        if (Functions & (1U << I))
+          (void) std::fprintf(stdout, ",%s", RangeFunctionNames[I]);
+      }
+      (void) std::fputs("\n", stdout);
+    }
+  } else if (A == 0UL) {
+    (void) std::fputs("0\n", stdout);
+    if (B == 0UL)
+      return 0;
+    A = 1UL;
+  }
+
+  Job.A = A;
+  Job.B = B;
+
+  uint64_t S = (uint64_t) std::sqrt((double) B);
+  if (S > 0xffffffffUL)
+    S = 0xffffffffUL;
+  while (S * S > B)
+    --S;
+  while ((S + 1UL) * (S + 1UL) <= B && S < 0xffffffffUL)
+    ++S;
+
+  Job.Limit = S < RangeSieveLimit ? (S > 2UL ? S : 2UL) : RangeSieveLimit;
+  SieveOddPrimes((uint32_t) Job.Limit, Job.Primes);
+
+  Job.Inv.resize(Job.Primes.size());
+  for (size_t I = 0UL; I < Job.Primes.size(); ++I) {
+    uint64_t Q = Job.Primes[I];
+    uint64_t QI = Q;
+    for (unsigned K = 0U; K < 5U; ++K)
+      QI *= 2UL - Q * QI;
+    Job.Inv[I] = QI;
+  }
+
+  Job.Segments = (B - A) / RangeSegment + 1UL;
+
+  if (Threads == 0U)
+    Threads = (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+  if (Threads == 0U)
+    Threads = 1U;
+
+  std::vector<pthread_t> TID(Threads);
+  for (uint32_t I = 0U; I < Threads; ++I)
+    (void) pthread_create(&TID[I], NULL, range_thread_start, &Job);
+
+  for (uint32_t I = 0U; I < Threads; ++I)
+    (void) pthread_join(TID[I], NULL);
+
+  (void) std::fflush(stdout);
+  return 0;
+}
+
+// -r <a>:<b>.
+static bool ParseRange(const char* S, uint64_t& A, uint64_t& B) {
+  const char* C = std::strchr(S, ':');
+  if (C == NULL)
+    return false;
+
+  const char* E = S + std::strlen(S);
+  std::from_chars_result RA = std::from_chars(S, C, A);
+  std::from_chars_result RB = std::from_chars(C + 1, E, B);
+
+  return RA.ec == std::errc() && RA.ptr == C && RB.ec == std::errc() &&
+    RB.ptr == E && A <= B;
+}
+
+// -m <name>[,<name>...], e.g. phi,mu.
+static bool ParseFunctions(const char* S, uint32_t& Functions) {
+  Functions = 0U;
+
+  for (;;) {
+    const char* C = std::strchr(S, ',');
+    size_t L = C ? (size_t) (C - S) : std::strlen(S);
+    uint32_t I = 0U;
+
+    while (I < 5U && (std::strlen(RangeFunctionNames[I]) != L ||
+                      std::strncmp(S, RangeFunctionNames[I], L) != 0))
+      ++I;
+
+    if (I == 5U)
+      return false;
+
+    Functions |= 1U << I;
+
+    if (C == NULL)
+      return true;
+
+    S = C + 1;
+  }
+}
+
 static void PrintUsage() {
   std::cerr << "Usage: primefactors <unsigned-integer> [ --check ]" << std::endl;
+  std::cerr << "       primefactors -f <file> (- = stdin) "
+    << "[ -t <threads> (default all CPUs)]" << std::endl;
+  std::cerr << "       primefactors -S <spf-table> <unsigned-integer>"
+    << std::endl;
+  std::cerr << "       (-S <spf-table> also applies to -f)" << std::endl;
+  std::cerr << "       primefactors -r <a>:<b> (every integer in [a, b]) "
+    << "[ -t <threads> ]" << std::endl;
+  std::cerr << "                    [ -m phi,sigma,tau,mu,omega "
+    << "(these functions instead of the factors)]" << std::endl;
+  std::cerr << "                    [ -o csv|binary (-m output, default csv)]"
+    << std::endl;
+}
+
+// Factors every number of the file (one per line) and writes one line
+// of p^e tokens per input line, in input order.
+static int BatchFactors(const char* Path, uint32_t Threads) {
+  std::ifstream F;
+  std::istream* In = &std::cin;
+
+  if (std::strcmp(Path, "-") != 0) {
+    F.open(Path);
+    if (!F) {
+      std::cerr << "Error: Could not open " << Path << ": "
+        << strerror(errno) << std::endl;
+      return 1;
+    }
+
+    In = &F;
+  }
+
+  if (Threads == 0U)
+    Threads = (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+
+  std::ios::sync_with_stdio(false);
+
+  BatchPool<factor_worker> Pool(Threads);
+  (void) Pool.Run(*In, stdout);
+
+  return 0;
 }
 
-static void PrintFactors(uint64_t N) {
-  std::cout << "Prime Factors of " << N << ":";
+static void PrintFactors(uint128_t N, const std::vector<uint128_t>& Factors) {
+  std::cout << "Prime Factors of " << ToDecimal(N) << ":";
 
   FM.clear();
 
-  for (std::multiset<uint64_t>::iterator I = Factors.begin();
+  for (std::vector<uint128_t>::const_iterator I = Factors.begin();
        I != Factors.end(); ++I) {
     if (!(FM.insert(std::make_pair(*I, 1U)).second)) {
-      std::map<uint64_t, uint32_t>::iterator MI = FM.find(*I);
+      std::map<uint128_t, uint32_t>::iterator MI = FM.find(*I);
       ++((*MI).second);
     }
   }
 
-  for (std::map<uint64_t, uint32_t>::iterator I = FM.begin();
+  for (std::map<uint128_t, uint32_t>::iterator I = FM.begin();
        I != FM.end(); ++I) {
-    std::cout << " " << (*I).first;
+    std::cout << " " << ToDecimal((*I).first);
   }
 
   std::cout << std::endl;
 
-  std::map<uint64_t, uint32_t>::const_iterator MIE;
+  std::map<uint128_t, uint32_t>::const_iterator MIE;
   std::cout << "Product: [";
 
-  for (std::map<uint64_t, uint32_t>::const_iterator MI = FM.begin();
+  for (std::map<uint128_t, uint32_t>::const_iterator MI = FM.begin();
        MI != FM.end(); ++MI) {
     if ((*MI).second == 1U)
-      std::cout << (*MI).first;
+      std::cout << ToDecimal((*MI).first);
     else
-      std::cout << '(' << (*MI).first << " ** " << (*MI).second << ')';
+      std::cout << '(' << ToDecimal((*MI).first) << " ** " << (*MI).second
+        << ')';
 
     MIE = MI;
     ++MIE;
@@ -162,22 +980,21 @@ static void PrintFactors(uint64_t N) {
   std::cout << ']' << std::endl;
 }
 
-int main(int argc, char* argv[])
-{
-  if (argc < 2) {
-    PrintUsage();
+static int FactorNumber(const char* S) {
+  uint128_t N;
+
+  if (!ParseUInt128(S, S + std::strlen(S), &N)) {
+    std::cerr << "Error: " << S << " is not an unsigned integer below 2^128!"
+      << std::endl;
     return 1;
   }
 
-  if (argc == 3 && strcmp(argv[2], "--check") == 0)
-    Check = true;
-
-  uint64_t N = (uint64_t) std::stoul(argv[1]);
+  std::vector<uint128_t> Factors;
 
   Timestamp(&tp_start);
-  PrimeFactors(N);
+  PrimeFactors128(N, Factors);
   Timestamp(&tp_end);
-  PrintFactors(N);
+  PrintFactors(N, Factors);
   PrintTimediff(&tp_start, &tp_end);
 
 
@@ -191,3 +1008,98 @@ int main(int argc, char* argv[])
   return 0;
 }
 
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    PrintUsage();
+    return 1;
+  }
+
+  if (argv[1][0] == '-' && std::strcmp(argv[1], "--check") != 0) {
+    const char* Path = NULL;
+    const char* Range = NULL;
+    uint32_t Threads = 0U;
+    uint32_t Functions = 0U;
+    bool Binary = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "hf:m:o:r:S:t:")) != -1) {
+      switch (c) {
+      case 'S':
+        if (!SPF.Open(optarg)) {
+          std::cerr << "Error: Could not map the SPF table " << optarg;
+          if (errno)
+            std::cerr << ": " << std::strerror(errno);
+          else
+            std::cerr << ": Invalid table";
+          std::cerr << '!' << std::endl;
+          return 1;
+        }
+        break;
+      case 'f':
+        Path = optarg;
+        break;
+      case 'm':
+        if (!ParseFunctions(optarg, Functions)) {
+          std::cerr << "Error: Invalid function list " << optarg << '!'
+            << std::endl;
+          return 1;
+        }
+        break;
+      case 'o':
+        if (std::strcmp(optarg, "binary") == 0) {
+          Binary = true;
+        } else if (std::strcmp(optarg, "csv") == 0) {
+          Binary = false;
+        } else {
+          PrintUsage();
+          return 1;
+        }
+        break;
+      case 'r':
+        Range = optarg;
+        break;
+      case 't':
+        Threads = (uint32_t) std::stoul(optarg);
+        break;
+      case 'h':
+        PrintUsage();
+        return 0;
+      default:
+        PrintUsage();
+        return 1;
+      }
+    }
+
+    // -S <table> <n> is a single query.
+    bool Single = Path == NULL && Range == NULL && optind == argc - 1;
+
+    if (Single)
+      return FactorNumber(argv[optind]);
+
+    if ((Path == NULL) == (Range == NULL) || optind != argc ||
+        (Functions && Range == NULL)) {
+      PrintUsage();
+      return 1;
+    }
+
+    if (Range) {
+      uint64_t A;
+      uint64_t B;
+
+      if (!ParseRange(Range, A, B)) {
+        std::cerr << "Error: Invalid range " << Range << '!' << std::endl;
+        return 1;
+      }
+
+      return RangeFactors(A, B, Threads, Functions, Binary);
+    }
+
+    return BatchFactors(Path, Threads);
+  }
+
+  if (argc == 3 && strcmp(argv[2], "--check") == 0)
+    Check = true;
+
+  return FactorNumber(argv[1]);
+}
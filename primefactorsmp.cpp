@@ -16,20 +16,31 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <iomanip>
 #include <string>
 #include <set>
 #include <map>
 #include <vector>
+#include <algorithm>
 #include <cstring>
 #include <cmath>
 #include <cstring>
 #include <ctime>
 #include <cerrno>
+#include <atomic>
 
 #include <unistd.h>
+#include <pthread.h>
 #include <gmp.h>
 
+#include "fixedmp.h"
+#include "prodtree.h"
+#include "smallprimes.h"
+#include "siqs.h"
+#include "batch.h"
+#include "factorcache.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -63,14 +74,16 @@ static void PrintTimespec(const struct timespec* ts) {
 static void PrintTimediff(const struct timespec* start,
                           const struct timespec* end) {
   uint64_t sec = (uint64_t) end->tv_sec - start->tv_sec;
-  uint64_t nns = (uint64_t) end->tv_nsec - start->tv_nsec;
+  uint64_t nns;
 
-  if (nns >= 1000000000) {
-    sec += nns / 1000000000;
-    nns = nns % 1000000000;
+  if (end->tv_nsec >= start->tv_nsec) {
+    nns = (uint64_t) end->tv_nsec - start->tv_nsec;
+  } else {
+    nns = (uint64_t) (end->tv_nsec + 1000000000L - start->tv_nsec);
+    --sec;
   }
 
-  std::cerr << "CPU time: " << sec << '.' << std::setfill('0') << std::setw(12)
+  std::cerr << "CPU time: " << sec << '.' << std::setfill('0') << std::setw(9)
     << nns << " second(s)." << std::endl;
 }
 
@@ -121,94 +134,1292 @@ public:
   }
 };
 
-std::multiset<MPZ*, mpz_less<MPZ*>> Factors;
+typedef std::multiset<MPZ*, mpz_less<MPZ*>> factor_set;
+
+// The outcome of one factorization. Composite is set when a cofactor
+// survived every stage within its bounds; it is then listed among the
+// factors as it is.
+struct factor_state {
+  factor_state() : Factors(), Composite(false) { }
+
+  ~factor_state() {
+    Clear();
+  }
+
+  void Clear() {
+    for (factor_set::iterator I = Factors.begin(); I != Factors.end(); ++I)
+      delete *I;
+
+    Factors.clear();
+    Composite = false;
+  }
+
+  void Insert(const mpz_t& P, uint32_t E, unsigned NumBits) {
+    for (uint32_t I = 0U; I < E; ++I)
+      Factors.insert(new MPZ(P, NumBits));
+  }
+
+  factor_set Factors;
+  bool Composite;
+};
+
 static unsigned NumBits = static_cast<unsigned>(~0x0);
+static uint32_t PrimeBound = 1048576U;
+static std::vector<uint32_t> SmallPrimes;
+static ProductTree SmallPrimeTree;
+
+// Stage bounds and wall-clock budgets in seconds, -1, -2, -R and -L.
+static uint64_t PM1B1 = 50000UL;
+static uint64_t PM1B2 = 0UL;
+static uint64_t RhoIterations = 1UL << 30;
+static double PM1Seconds = 2.0;
+static double RhoSeconds = 1.0;
+static double ECMSeconds = 600.0;
+static uint32_t ECMDigits = 50U;
+static uint32_t NThreads = 0U;
+static double SIQSSeconds = 3600.0;
+static uint32_t SIQSDigits = 40U;
+
+// In batch mode every worker factors its own numbers: ECM and SIQS run
+// on one thread and print nothing.
+static uint32_t StageThreads = 0U;
+static bool Verbose = true;
+static std::atomic<bool> Incomplete(false);
+
+// -C: results are looked up in and added to a persistent cache.
+static FactorCache* Cache = NULL;
+
+static std::vector<uint32_t> StagePrimes;
+
+// A wall-clock deadline, checked every so many iterations of a stage.
+struct deadline {
+  explicit deadline(double Seconds) : End() {
+    (void) clock_gettime(CLOCK_MONOTONIC, &End);
+
+    double S = std::floor(Seconds);
+    End.tv_sec += (time_t) S;
+    End.tv_nsec += (long) ((Seconds - S) * 1.0e9);
+
+    if (End.tv_nsec >= 1000000000L) {
+      End.tv_nsec -= 1000000000L;
+      ++End.tv_sec;
+    }
+  }
+
+  bool Expired() const {
+    struct timespec Now;
+    (void) clock_gettime(CLOCK_MONOTONIC, &Now);
+
+    return Now.tv_sec > End.tv_sec ||
+      (Now.tv_sec == End.tv_sec && Now.tv_nsec >= End.tv_nsec);
+  }
+
+  struct timespec End;
+};
+
+// A proper factor F of N, if gcd(G, N) is one.
+static inline bool ProperFactor(mpz_t& F, const mpz_t& G, const mpz_t& N) {
+  mpz_gcd(F, G, N);
+  return mpz_cmp_ui(F, 1UL) != 0 && mpz_cmp(F, N) != 0;
+}
+
+// If N = R^K for some K > 1, sets R and returns K; otherwise 1.
+static uint32_t PerfectPower(mpz_t& R, const mpz_t& N) {
+  if (!mpz_perfect_power_p(N))
+    return 1U;
+
+  size_t NB = mpz_sizeinbase(N, 2);
+
+  for (uint32_t K = 2U; K <= NB; ++K) {
+    if (mpz_root(R, N, K))
+      return K;
+  }
+
+  return 1U;
+}
+
+// Pollard p-1. Stage 1 raises X = 3 to the product of all prime powers up
+// to B1, accumulating the exponent in chunks so that each mpz_powm covers
+// many primes. Stage 2 (standard continuation) looks for one more prime
+// q in (B1, B2]: X^q is stepped from prime to prime with a table of X^d
+// for the even gaps d, and the X^q - 1 are multiplied together with one
+// gcd every 1024 primes.
+static bool PollardPM1(mpz_t& F, const mpz_t& N) {
+  deadline DL(PM1Seconds);
+  uint64_t B2 = PM1B2 ? PM1B2 : 100UL * PM1B1;
+
+  mpz_t X;
+  mpz_t E;
+  mpz_t T;
+  mpz_init_set_ui(X, 3UL);
+  mpz_init_set_ui(E, 1UL);
+  mpz_init(T);
+
+  bool Found = false;
+  bool Expired = false;
+  size_t PI = 0UL;
+
+  for ( ; PI < StagePrimes.size() && StagePrimes[PI] <= PM1B1; ++PI) {
+    uint64_t P = StagePrimes[PI];
+    uint64_t Q = P;
+    while (Q <= PM1B1 / P)
+      Q *= P;
+
+    mpz_mul_ui(E, E, Q);
+
+    if (mpz_sizeinbase(E, 2) >= 4096UL) {
+      mpz_powm(X, X, E, N);
+      mpz_set_ui(E, 1UL);
+
+      if (DL.Expired()) {
+        Expired = true;
+        break;
+      }
+    }
+  }
+
+  mpz_powm(X, X, E, N);
+  mpz_sub_ui(T, X, 1UL);
+  Found = ProperFactor(F, T, N);
+
+  if (!Found && !Expired && mpz_cmp(F, N) != 0 && PI < StagePrimes.size()) {
+    std::vector<MPZ*> Gaps;
+    mpz_t Y;
+    mpz_t A;
+    mpz_init(Y);
+    mpz_init_set_ui(A, 1UL);
+
+    uint64_t QP = StagePrimes[PI];
+    mpz_powm_ui(Y, X, QP, N);
+
+    for (size_t K = 0UL; PI < StagePrimes.size() && StagePrimes[PI] <= B2;
+         ++K) {
+      if (K) {
+        uint64_t D = (StagePrimes[PI] - QP) / 2UL;
+
+        while (Gaps.size() <= D)
+          Gaps.push_back(NULL);
+
+        if (Gaps[D] == NULL) {
+          mpz_powm_ui(T, X, 2UL * D, N);
+          Gaps[D] = new MPZ(T, NumBits);
+        }
+
+        mpz_mul(Y, Y, Gaps[D]->MP);
+        mpz_mod(Y, Y, N);
+        QP = StagePrimes[PI];
+      }
+
+      mpz_sub_ui(T, Y, 1UL);
+      mpz_mul(A, A, T);
+      mpz_mod(A, A, N);
+      ++PI;
+
+      if ((K & 1023UL) == 1023UL) {
+        if (ProperFactor(F, A, N)) {
+          Found = true;
+          break;
+        }
 
-static void PrimeFactors(mpz_t N, unsigned NumBits) {
+        if (DL.Expired())
+          break;
+      }
+    }
+
+    if (!Found)
+      Found = ProperFactor(F, A, N);
+
+    for (size_t D = 0UL; D < Gaps.size(); ++D)
+      delete Gaps[D];
+
+    mpz_clear(A);
+    mpz_clear(Y);
+  }
+
+  mpz_clear(T);
+  mpz_clear(E);
+  mpz_clear(X);
+
+  return Found;
+}
+
+// Brent's variant of Pollard's rho, x -> x^2 + C, on the fixed-width
+// Montgomery integers of fixedmp.h. The differences are multiplied
+// together and one gcd is taken every BatchSteps steps; a batch that
+// overshoots to gcd = N is replayed one step at a time.
+static const uint64_t RhoBatchSteps = 128UL;
+
+template<unsigned Limbs>
+static bool PollardBrentFixed(mpz_t& F, const mpz_t& N, uint64_t C,
+                              uint64_t& Budget, const deadline& DL) {
+  FixedMontgomery<Limbs> M;
+  M.Init(N);
+
+  FixedMP<Limbs> MC;
+  FixedMP<Limbs> Y;
+  FixedMP<Limbs> Q = M.One;
+  FixedMP<Limbs> D;
+
+  FixedSetUI(D, C);
+  M.ToMont(MC, D);
+  FixedSetUI(D, 2UL);
+  M.ToMont(Y, D);
+
+  FixedMP<Limbs> X = Y;
+  FixedMP<Limbs> YS = Y;
+
+  mpz_t G;
+  mpz_init_set_ui(G, 1UL);
+  bool Failed = false;
+
+  for (uint64_t R = 1UL; mpz_cmp_ui(G, 1UL) == 0; R <<= 1) {
+    X = Y;
+
+    for (uint64_t I = 0UL; I < R; ++I) {
+      M.Sqr(Y, Y);
+      M.AddMod(Y, Y, MC);
+    }
+
+    for (uint64_t K = 0UL; K < R && mpz_cmp_ui(G, 1UL) == 0;
+         K += RhoBatchSteps) {
+      YS = Y;
+
+      uint64_t L = R - K < RhoBatchSteps ? R - K : RhoBatchSteps;
+      for (uint64_t I = 0UL; I < L; ++I) {
+        M.Sqr(Y, Y);
+        M.AddMod(Y, Y, MC);
+        M.SubMod(D, X, Y);
+        M.Mul(Q, Q, D);
+      }
+
+      FixedGet(G, Q);
+      mpz_gcd(G, G, N);
+    }
+
+    Budget = Budget > 2UL * R ? Budget - 2UL * R : 0UL;
+    if (mpz_cmp_ui(G, 1UL) == 0 && (Budget == 0UL || DL.Expired())) {
+      Failed = true;
+      break;
+    }
+  }
+
+  if (!Failed && mpz_cmp(G, N) == 0) {
+    do {
+      M.Sqr(YS, YS);
+      M.AddMod(YS, YS, MC);
+      M.SubMod(D, X, YS);
+      FixedGet(G, D);
+      mpz_gcd(G, G, N);
+    } while (mpz_cmp_ui(G, 1UL) == 0);
+  }
+
+  bool Found = !Failed && mpz_cmp(G, N) != 0;
+  if (Found)
+    mpz_set(F, G);
+
+  mpz_clear(G);
+  return Found;
+}
+
+// The same with mpz_t arithmetic, for cofactors wider than 256 bits.
+static bool PollardBrentMP(mpz_t& F, const mpz_t& N, uint64_t C,
+                           uint64_t& Budget, const deadline& DL) {
+  mpz_t Y;
+  mpz_t X;
+  mpz_t YS;
   mpz_t Q;
-  mpz_t R;
   mpz_t D;
-  mpz_t Z;
-  mpz_t NL;
+  mpz_t G;
 
-  mpz_init2(Q, NumBits);
-  mpz_init2(R, NumBits);
-  mpz_init2(D, NumBits);
-  mpz_init2(Z, NumBits);
-  mpz_init2(NL, NumBits);
+  mpz_init_set_ui(Y, 2UL);
+  mpz_init(X);
+  mpz_init_set(YS, Y);
+  mpz_init_set_ui(Q, 1UL);
+  mpz_init(D);
+  mpz_init_set_ui(G, 1UL);
+
+  bool Failed = false;
+
+  for (uint64_t R = 1UL; mpz_cmp_ui(G, 1UL) == 0; R <<= 1) {
+    mpz_set(X, Y);
+
+    for (uint64_t I = 0UL; I < R; ++I) {
+      mpz_mul(Y, Y, Y);
+      mpz_add_ui(Y, Y, C);
+      mpz_mod(Y, Y, N);
+    }
+
+    for (uint64_t K = 0UL; K < R && mpz_cmp_ui(G, 1UL) == 0;
+         K += RhoBatchSteps) {
+      mpz_set(YS, Y);
+
+      uint64_t L = R - K < RhoBatchSteps ? R - K : RhoBatchSteps;
+      for (uint64_t I = 0UL; I < L; ++I) {
+        mpz_mul(Y, Y, Y);
+        mpz_add_ui(Y, Y, C);
+        mpz_mod(Y, Y, N);
+        mpz_sub(D, X, Y);
+        mpz_mul(Q, Q, D);
+        mpz_mod(Q, Q, N);
+      }
+
+      mpz_gcd(G, Q, N);
+    }
+
+    Budget = Budget > 2UL * R ? Budget - 2UL * R : 0UL;
+    if (mpz_cmp_ui(G, 1UL) == 0 && (Budget == 0UL || DL.Expired())) {
+      Failed = true;
+      break;
+    }
+  }
+
+  if (!Failed && mpz_cmp(G, N) == 0) {
+    do {
+      mpz_mul(YS, YS, YS);
+      mpz_add_ui(YS, YS, C);
+      mpz_mod(YS, YS, N);
+      mpz_sub(D, X, YS);
+      mpz_gcd(G, D, N);
+    } while (mpz_cmp_ui(G, 1UL) == 0);
+  }
+
+  bool Found = !Failed && mpz_cmp(G, N) != 0;
+  if (Found)
+    mpz_set(F, G);
+
+  mpz_clear(G);
+  mpz_clear(D);
+  mpz_clear(Q);
+  mpz_clear(YS);
+  mpz_clear(X);
+  mpz_clear(Y);
+
+  return Found;
+}
+
+// Tries a few constants C until a proper factor turns up or the
+// iteration or time budget runs out.
+static bool PollardBrent(mpz_t& F, const mpz_t& N) {
+  deadline DL(RhoSeconds);
+  uint64_t Budget = RhoIterations;
+  size_t NS = mpz_size(N);
+
+  for (uint64_t C = 1UL; Budget && !DL.Expired(); ++C) {
+    bool Found;
+
+    if (NS <= 2UL)
+      Found = PollardBrentFixed<2>(F, N, C, Budget, DL);
+    else if (NS <= 3UL)
+      Found = PollardBrentFixed<3>(F, N, C, Budget, DL);
+    else if (NS <= 4UL)
+      Found = PollardBrentFixed<4>(F, N, C, Budget, DL);
+    else
+      Found = PollardBrentMP(F, N, C, Budget, DL);
+
+    if (Found)
+      return true;
+  }
+
+  return false;
+}
+
+// Lenstra's elliptic curve method on Montgomery curves By^2 = x^3 + Ax^2 + x
+// in projective (X : Z) coordinates, with Suyama's parametrization: for
+// sigma >= 6, u = sigma^2 - 5, v = 4 sigma, the starting point is
+// (u^3 : v^3) and (A + 2) / 4 = (v - u)^3 (3u + v) / (16 u^3 v). The
+// group order of such curves is divisible by 12.
+//
+// Stage 1 multiplies the point by every prime power up to B1 with the
+// Montgomery ladder. Stage 2 (baby-step giant-step) covers one more prime
+// q in (B1, B2]: with q = iD +/- j, [q]Q = O mod p iff x([iD]Q) =
+// x([j]Q) mod p, so the differences X(iD) - x(j) Z(iD) of the giant steps
+// against the normalized baby steps are multiplied together.
+//
+// The curves run in parallel on -T threads. The digit levels follow the
+// usual table of B1 and expected number of curves for B2 = 100 B1 (see
+// the GMP-ECM documentation); the first factor found cancels the rest.
+
+struct ecm_level {
+  uint32_t Digits;
+  uint64_t B1;
+  uint64_t Curves;
+};
+
+static const ecm_level ECMLevels[] = {
+  { 15U, 2000UL, 25UL },
+  { 20U, 11000UL, 90UL },
+  { 25U, 50000UL, 300UL },
+  { 30U, 250000UL, 700UL },
+  { 35U, 1000000UL, 1800UL },
+  { 40U, 3000000UL, 5100UL },
+  { 45U, 11000000UL, 10600UL },
+  { 50U, 43000000UL, 19300UL },
+  { 55U, 110000000UL, 49000UL },
+  { 60U, 260000000UL, 124000UL }
+};
+
+static const uint32_t ECMGiantStep = 2310U;
+static const uint32_t ECMGiantBlock = 64U;
+
+// Shared state of the curves of one digit level.
+struct ecm_job {
+  ecm_job() : N(), F(), B1(0UL), B2(0UL), Curves(0UL), Next(0UL), Done(0UL),
+    Sigma(6UL), Primes(), SievePrimes(), Stop(false), DL(NULL), Mutex() {
+    mpz_init(N);
+    mpz_init(F);
+    pthread_mutex_init(&Mutex, NULL);
+  }
+
+  ~ecm_job() {
+    pthread_mutex_destroy(&Mutex);
+    mpz_clear(F);
+    mpz_clear(N);
+  }
+
+  mpz_t N;
+  mpz_t F;
+  uint64_t B1;
+  uint64_t B2;
+  uint64_t Curves;
+  uint64_t Next;
+  uint64_t Done;
+  uint64_t Sigma;
+  std::vector<uint32_t> Primes;
+  std::vector<uint32_t> SievePrimes;
+  std::atomic<bool> Stop;
+  const deadline* DL;
+  pthread_mutex_t Mutex;
+};
+
+
+// Residues modulo N as mpz_t, for moduli wider than 512 bits.
+struct ecm_mpz_ring {
+  struct value {
+    value() {
+      mpz_init(V);
+    }
+
+    ~value() {
+      mpz_clear(V);
+    }
+
+    value(const value&) = delete;
+
+    value& operator=(const value& R) {
+      mpz_set(V, R.V);
+      return *this;
+    }
+
+    mpz_t V;
+  };
+
+  explicit ecm_mpz_ring(const mpz_t& n) {
+    mpz_init_set(N, n);
+  }
+
+  ~ecm_mpz_ring() {
+    mpz_clear(N);
+  }
+
+  inline void Mul(value& R, const value& A, const value& B) const {
+    mpz_mul(R.V, A.V, B.V);
+    mpz_mod(R.V, R.V, N);
+  }
+
+  inline void Add(value& R, const value& A, const value& B) const {
+    mpz_add(R.V, A.V, B.V);
+    if (mpz_cmp(R.V, N) >= 0)
+      mpz_sub(R.V, R.V, N);
+  }
+
+  inline void Sub(value& R, const value& A, const value& B) const {
+    mpz_sub(R.V, A.V, B.V);
+    if (mpz_sgn(R.V) < 0)
+      mpz_add(R.V, R.V, N);
+  }
+
+  inline void Set(value& R, const mpz_t& X) const {
+    mpz_mod(R.V, X, N);
+  }
+
+  inline void Get(mpz_t& R, const value& A) const {
+    mpz_set(R, A.V);
+  }
+
+  mpz_t N;
+};
+
+// Residues modulo N in Montgomery form on the fixed-width integers of
+// fixedmp.h.
+template<unsigned Limbs>
+struct ecm_fixed_ring {
+  typedef FixedMP<Limbs> value;
+
+  explicit ecm_fixed_ring(const mpz_t& n) : M() {
+    M.Init(n);
+    mpz_init_set(N, n);
+    mpz_init(T);
+  }
+
+  ~ecm_fixed_ring() {
+    mpz_clear(T);
+    mpz_clear(N);
+  }
+
+  inline void Mul(value& R, const value& A, const value& B) const {
+    M.Mul(R, A, B);
+  }
+
+  inline void Add(value& R, const value& A, const value& B) const {
+    M.AddMod(R, A, B);
+  }
+
+  inline void Sub(value& R, const value& A, const value& B) const {
+    M.SubMod(R, A, B);
+  }
+
+  inline void Set(value& R, const mpz_t& X) {
+    value U;
+    mpz_mod(T, X, N);
+    FixedSet(U, T);
+    M.ToMont(R, U);
+  }
+
+  inline void Get(mpz_t& R, const value& A) const {
+    value U;
+    M.FromMont(U, A);
+    FixedGet(R, U);
+  }
+
+  FixedMontgomery<Limbs> M;
+  mpz_t N;
+  mpz_t T;
+};
+
+template<typename Ring>
+struct ecm_point {
+  ecm_point() : X(), Z() { }
+
+  ecm_point(const ecm_point&) = delete;
+  ecm_point& operator=(const ecm_point&) = delete;
+
+  void Set(const ecm_point& P) {
+    X = P.X;
+    Z = P.Z;
+  }
+
+  typename Ring::value X;
+  typename Ring::value Z;
+};
+
+// One thread's curve arithmetic modulo N, with preallocated temporaries.
+// The curve setup, the inversions and the gcds are done with mpz_t; the
+// ladders and stage 2 stay in Ring.
+template<typename Ring>
+class ECMCurve {
+public:
+  typedef typename Ring::value value;
+  typedef ecm_point<Ring> point;
+
+  explicit ECMCurve(ecm_job& J) : Job(J), R(J.N), A24(), T1(), T2(), T3(),
+    T4() {
+    mpz_init_set(N, Job.N);
+    mpz_init(M1);
+    mpz_init(M2);
+  }
+
+  ~ECMCurve() {
+    mpz_clear(M2);
+    mpz_clear(M1);
+    mpz_clear(N);
+  }
+
+  // Runs one curve; returns true and sets F if it found a proper factor.
+  bool Run(uint64_t Sigma, mpz_t& F) {
+    point Q;
+
+    if (Init(Sigma, Q, F))
+      return true;
+
+    if (Stage1(Q, F))
+      return true;
+
+    if (Job.Stop.load(std::memory_order_relaxed) || Job.DL->Expired())
+      return false;
+
+    return Stage2(Q, F);
+  }
+
+private:
+  ECMCurve(const ECMCurve&) = delete;
+  ECMCurve& operator=(const ECMCurve&) = delete;
+
+  // Suyama's parametrization. A failed inversion is a factor too.
+  bool Init(uint64_t Sigma, point& Q, mpz_t& F) {
+    mpz_t U;
+    mpz_t V;
+    mpz_init_set_ui(U, Sigma);
+    mpz_init_set_ui(V, Sigma);
+
+    mpz_mul(U, U, U);
+    mpz_sub_ui(U, U, 5UL);
+    mpz_mul_ui(V, V, 4UL);
+
+    mpz_powm_ui(M1, U, 3UL, N);
+    R.Set(Q.X, M1);
+    mpz_powm_ui(M2, V, 3UL, N);
+    R.Set(Q.Z, M2);
+
+    // M1 = 16 u^3 v.
+    mpz_mul_ui(M1, M1, 16UL);
+    mpz_mul(M1, M1, V);
+    mpz_mod(M1, M1, N);
+
+    bool Found = false;
+
+    if (!mpz_invert(M2, M1, N)) {
+      Found = ProperFactor(F, M1, N);
+    } else {
+      mpz_sub(M1, V, U);
+      mpz_powm_ui(M1, M1, 3UL, N);
+      mpz_mul(M1, M1, M2);
+      mpz_mul_ui(U, U, 3UL);
+      mpz_add(U, U, V);
+      mpz_mul(M1, M1, U);
+      mpz_mod(M1, M1, N);
+      R.Set(A24, M1);
+    }
+
+    mpz_clear(V);
+    mpz_clear(U);
+
+    return Found;
+  }
+
+  // D = 2P.
+  void Double(point& D, const point& P) {
+    R.Add(T1, P.X, P.Z);
+    R.Mul(T1, T1, T1);
+    R.Sub(T2, P.X, P.Z);
+    R.Mul(T2, T2, T2);
+    R.Mul(D.X, T1, T2);
+    R.Sub(T3, T1, T2);
+    R.Mul(T4, T3, A24);
+    R.Add(T4, T4, T2);
+    R.Mul(D.Z, T3, T4);
+  }
+
+  // S = P + Q, given D = P - Q. S may alias P or Q, not D.
+  void Add(point& S, const point& P, const point& Q, const point& D) {
+    R.Sub(T1, P.X, P.Z);
+    R.Add(T2, Q.X, Q.Z);
+    R.Mul(T1, T1, T2);
+    R.Add(T2, P.X, P.Z);
+    R.Sub(T3, Q.X, Q.Z);
+    R.Mul(T2, T2, T3);
+    R.Add(T3, T1, T2);
+    R.Sub(T4, T1, T2);
+    R.Mul(T3, T3, T3);
+    R.Mul(T4, T4, T4);
+    R.Mul(S.X, D.Z, T3);
+    R.Mul(S.Z, D.X, T4);
+  }
+
+  // P = [K]P with the Montgomery ladder, K >= 2.
+  void Ladder(point& P, uint64_t K) {
+    point R0;
+    point R1;
+
+    R0.Set(P);
+    Double(R1, P);
+
+    for (int B = 62 - __builtin_clzl(K); B >= 0; --B) {
+      if ((K >> B) & 1UL) {
+        Add(R0, R1, R0, P);
+        Double(R1, R1);
+      } else {
+        Add(R1, R1, R0, P);
+        Double(R0, R0);
+      }
+    }
+
+    P.Set(R0);
+  }
+
+  bool Stage1(point& Q, mpz_t& F) {
+    const std::vector<uint32_t>& P = Job.Primes;
+
+    for (size_t I = 0UL; I < P.size() && P[I] <= Job.B1; ++I) {
+      uint64_t PK = P[I];
+      while (PK <= Job.B1 / P[I])
+        PK *= P[I];
+
+      Ladder(Q, PK);
+
+      if ((I & 255UL) == 255UL &&
+          (Job.Stop.load(std::memory_order_relaxed) || Job.DL->Expired()))
+        return false;
+    }
+
+    R.Get(M1, Q.Z);
+    return ProperFactor(F, M1, N);
+  }
+
+  bool Stage2(const point& Q, mpz_t& F) {
+    const uint64_t D = ECMGiantStep;
+
+    // Baby steps: the odd multiples [j]Q, j < D / 2, normalized to Z = 1
+    // for the j coprime to D.
+    std::vector<uint32_t> J;
+    for (uint64_t j = 1UL; j < D / 2UL; j += 2UL) {
+      if (j % 3UL && j % 5UL && j % 7UL && j % 11UL)
+        J.push_back((uint32_t) j);
+    }
+
+    value* BX = new value[J.size()];
+    point Q2;
+    point Prev;
+    point Cur;
+    point T;
+    bool Found = false;
+
+    // Cur = [j]Q and Prev = [j - 2]Q; [-1]Q has the same x as Q.
+    Double(Q2, Q);
+    Prev.Set(Q);
+    Cur.Set(Q);
+
+    for (uint64_t j = 1UL, K = 0UL; K < J.size(); j += 2UL) {
+      if (j > 1UL) {
+        Add(T, Cur, Q2, Prev);
+        Prev.Set(Cur);
+        Cur.Set(T);
+      }
+
+      if (j != J[K])
+        continue;
+
+      R.Get(M1, Cur.Z);
+      if (!mpz_invert(M2, M1, N)) {
+        Found = ProperFactor(F, M1, N);
+        break;
+      }
+
+      R.Get(M1, Cur.X);
+      mpz_mul(M1, M1, M2);
+      R.Set(BX[K], M1);
+      ++K;
+    }
+
+    if (Found) {
+      delete [] BX;
+      return true;
+    }
 
-  mpz_set(NL, N);
-  mpz_set_ui(D, 2UL);
-  mpz_set_ui(Z, 0UL);
+    // Giant steps G(i) = [iD]Q, from i0 = B1 / D on.
+    uint64_t I0 = Job.B1 / D ? Job.B1 / D : 1UL;
+    uint64_t IE = Job.B2 / D + 1UL;
+    point GD;
+    point G0;
+    point G1;
 
-  mpz_mod(R, NL, D);
+    GD.Set(Q);
+    Ladder(GD, D);
+    G0.Set(Q);
+    Ladder(G0, I0 * D);
+    G1.Set(Q);
+    Ladder(G1, (I0 + 1UL) * D);
 
-  while (mpz_cmpabs(R, Z) == 0) {
-    Factors.insert(new MPZ(D, NumBits));
-    mpz_cdiv_q(Q, NL, D);
-    mpz_set(NL, Q);
-    mpz_mod(R, NL, D);
+    value Acc;
+    mpz_set_ui(M1, 1UL);
+    R.Set(Acc, M1);
+
+    std::vector<uint8_t> C;
+
+    for (uint64_t IB = I0; IB <= IE; IB += ECMGiantBlock) {
+      // Primality of [IB * D - D / 2, (IB + Block) * D + D / 2).
+      uint64_t Lo = IB * D - D / 2UL;
+      uint64_t Hi = (IB + ECMGiantBlock) * D + D / 2UL;
+      SieveSegment(Lo, Hi, C);
+
+      for (uint64_t I = IB; I < IB + ECMGiantBlock && I <= IE; ++I) {
+        const point& G = I == I0 ? G0 : G1;
+
+        for (size_t K = 0UL; K < J.size(); ++K) {
+          uint64_t QP = I * D + J[K];
+          uint64_t QM = I * D - J[K];
+          bool PP = QP > Job.B1 && QP <= Job.B2 && !C[QP - Lo];
+          bool PM = QM > Job.B1 && QM <= Job.B2 && !C[QM - Lo];
+
+          if (PP || PM) {
+            R.Mul(T1, BX[K], G.Z);
+            R.Sub(T1, G.X, T1);
+            R.Mul(Acc, Acc, T1);
+          }
+        }
+
+        if (I != I0) {
+          Add(T, G1, GD, G0);
+          G0.Set(G1);
+          G1.Set(T);
+        }
+      }
+
+      if (Job.Stop.load(std::memory_order_relaxed) || Job.DL->Expired())
+        break;
+    }
+
+    R.Get(M1, Acc);
+    Found = ProperFactor(F, M1, N);
+
+    delete [] BX;
+    return Found;
+  }
+
+  // C[I] != 0 iff Lo + I is composite, for Lo > sqrt(Hi).
+  void SieveSegment(uint64_t Lo, uint64_t Hi, std::vector<uint8_t>& C) {
+    C.assign(Hi - Lo, 0U);
+
+    const std::vector<uint32_t>& SP = Job.SievePrimes;
+    for (size_t I = 0UL; I < SP.size(); ++I) {
+      uint64_t P = SP[I];
+      if (P * P >= Hi)
+        break;
+
+      uint64_t S = (Lo + P - 1UL) / P * P;
+      if (S < P * P)
+        S = P * P;
+
+      for (uint64_t K = S; K < Hi; K += P)
+        C[K - Lo] = 1U;
+    }
   }
 
-  mpz_t S;
-  mpz_init2(S, NumBits);
+  ecm_job& Job;
+  Ring R;
+  mpz_t N;
+  mpz_t M1;
+  mpz_t M2;
+  value A24;
+  value T1;
+  value T2;
+  value T3;
+  value T4;
+};
+
+// Runs curves of the current level until they are used up or cancelled.
+template<typename Ring>
+static void ECMCurves(ecm_job& Job) {
+  mpz_t F;
+  mpz_init(F);
+  ECMCurve<Ring> EC(Job);
 
-  mpz_sqrt(S, NL);
+  for (;;) {
+    pthread_mutex_lock(&Job.Mutex);
+    bool Done = Job.Stop.load() || Job.Next >= Job.Curves;
+    uint64_t Sigma = Job.Sigma++;
+    if (!Done)
+      ++Job.Next;
+    pthread_mutex_unlock(&Job.Mutex);
 
+    if (Done || Job.DL->Expired())
+      break;
+
+    bool Found = EC.Run(Sigma, F);
+
+    pthread_mutex_lock(&Job.Mutex);
+    if (Found && !Job.Stop.load()) {
+      mpz_set(Job.F, F);
+      Job.Stop.store(true);
+    }
+    if (!Job.Stop.load() || Found)
+      ++Job.Done;
+    pthread_mutex_unlock(&Job.Mutex);
+  }
+
+  mpz_clear(F);
+}
+
+extern "C" {
+  void* ecm_thread_start(void* Arg) {
+    ecm_job& Job = *(ecm_job*) Arg;
+    size_t NS = mpz_size(Job.N);
+
+    if (NS <= 2UL)
+      ECMCurves<ecm_fixed_ring<2>>(Job);
+    else if (NS <= 3UL)
+      ECMCurves<ecm_fixed_ring<3>>(Job);
+    else if (NS <= 4UL)
+      ECMCurves<ecm_fixed_ring<4>>(Job);
+    else if (NS <= 8UL)
+      ECMCurves<ecm_fixed_ring<8>>(Job);
+    else
+      ECMCurves<ecm_mpz_ring>(Job);
+
+    return NULL;
+  }
+}
+
+static uint32_t Threads() {
+  if (StageThreads)
+    return StageThreads;
+
+  uint32_t NT = NThreads ? NThreads : (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+  return NT ? NT : 1U;
+}
+
+// Runs the ECM digit levels up to MaxDigits on N, within ECMSeconds.
+static bool ECM(mpz_t& F, const mpz_t& N, uint32_t MaxDigits) {
+  deadline DL(ECMSeconds);
+  uint32_t NT = Threads();
+
+  std::vector<pthread_t> Threads(NT);
+  ecm_job Job;
+  mpz_set(Job.N, N);
+  Job.DL = &DL;
+  Job.Stop.store(false);
+
+  for (size_t L = 0UL; L < sizeof(ECMLevels) / sizeof(ECMLevels[0]); ++L) {
+    const ecm_level& EL = ECMLevels[L];
+
+    // A factor of more than half the digits of N would leave a smaller
+    // cofactor, which the previous levels would have found.
+    if (EL.Digits > MaxDigits || DL.Expired() ||
+        EL.Digits > mpz_sizeinbase(N, 10) / 2UL + 5UL)
+      break;
+
+    Job.B1 = EL.B1;
+    Job.B2 = 100UL * EL.B1;
+    Job.Curves = EL.Curves;
+    Job.Next = 0UL;
+    Job.Done = 0UL;
+    SievePrimes((uint32_t) EL.B1, Job.Primes);
+    SievePrimes((uint32_t) std::sqrt((double) Job.B2) + 1U,
+                Job.SievePrimes);
+
+    struct timespec TB;
+    struct timespec TE;
+    (void) clock_gettime(CLOCK_MONOTONIC, &TB);
+
+    for (uint32_t I = 0U; I < NT; ++I)
+      (void) pthread_create(&Threads[I], NULL, ecm_thread_start, &Job);
+
+    for (uint32_t I = 0U; I < NT; ++I)
+      (void) pthread_join(Threads[I], NULL);
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &TE);
+
+    double WS = (double) (TE.tv_sec - TB.tv_sec) +
+      (double) (TE.tv_nsec - TB.tv_nsec) / 1.0e9;
+
+    if (Verbose)
+      (void) std::fprintf(stderr, "ECM: %u digits, B1 = %lu, B2 = %lu: "
+                          "%lu of %lu expected curves in %.3f seconds "
+                          "(%.2f curves/sec, %u threads)%s\n", EL.Digits,
+                          Job.B1, Job.B2, Job.Done, Job.Curves, WS,
+                          WS > 0.0 ? (double) Job.Done / WS : 0.0, NT,
+                          Job.Stop.load() ? ", factor found." : ".");
+
+    if (Job.Stop.load()) {
+      mpz_set(F, Job.F);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Removes the small prime factors of NL: the compile-time table first,
+// then the primes up to PrimeBound through the product tree.
+static void SmallFactors(mpz_t& NL, factor_state& FS, unsigned NumBits) {
   mpz_t I;
   mpz_init2(I, NumBits);
-  mpz_set_ui(I, 3UL);
 
-  int K = mpz_cmp(I, S);
+  if (mpz_even_p(NL) && mpz_sgn(NL)) {
+    mp_bitcnt_t Z = mpz_scan1(NL, 0UL);
+    mpz_set_ui(I, 2UL);
+    FS.Insert(I, (uint32_t) Z, NumBits);
+    mpz_tdiv_q_2exp(NL, NL, Z);
+  }
+
+  // The primes below SmallPrimeLimit: one division by the product of a
+  // group of them leaves a 64-bit remainder, which is tested against
+  // every prime of the group with a multiplication and a comparison.
+  for (size_t GI = 0UL; GI < SmallPrimeGroupCount; ++GI) {
+    const small_prime_group& G = SmallPrimeGroups[GI];
+    uint64_t GR = mpz_fdiv_ui(NL, G.Product);
 
-  while (K <= 0) {
-    mpz_mod(R, NL, I);
+    for (uint32_t J = G.Begin; J < G.End; ++J) {
+      if (!DividesSmall(SmallPrimeTable[J], GR))
+        continue;
 
-    while (mpz_cmpabs(R, Z) == 0) {
-      Factors.insert(new MPZ(I, NumBits));
-      mpz_cdiv_q(Q, NL, I);
-      mpz_set(NL, Q);
-      mpz_mod(R, NL, I);
+      mpz_set_ui(I, SmallPrimeTable[J].P);
+
+      while (mpz_divisible_ui_p(NL, SmallPrimeTable[J].P)) {
+        FS.Insert(I, 1U, NumBits);
+        mpz_divexact_ui(NL, NL, SmallPrimeTable[J].P);
+      }
     }
+  }
+
+  // Larger small factors: one gcd with the primorial of the primes up to
+  // PrimeBound tells whether there are any, and a descent through the
+  // product tree of those primes tells which ones.
+  if (PrimeBound > SmallPrimeLimit) {
+    std::vector<size_t> Idx;
+    SmallPrimeTree.CommonFactors(NL, Idx);
 
-    mpz_add_ui(I, I, 2UL);
-    K = mpz_cmp(I, S);
+    for (std::vector<size_t>::const_iterator PI = Idx.begin();
+         PI != Idx.end(); ++PI) {
+      mpz_set_ui(I, SmallPrimes[*PI]);
+
+      while (mpz_divisible_p(NL, I)) {
+        FS.Insert(I, 1U, NumBits);
+        mpz_divexact(NL, NL, I);
+      }
+    }
   }
 
-  K = mpz_cmp(NL, D);
+  mpz_clear(I);
+}
+
+// Splits the composite N with p-1, Brent's rho and ECM. From SIQSDigits
+// on, ECM only looks for factors up to about 30% of the digits of N, as
+// the quadratic sieve, whose running time depends only on the size of N,
+// is then the faster way to a larger one.
+static bool Split(mpz_t& F, const mpz_t& N) {
+  uint32_t Digits = (uint32_t) mpz_sizeinbase(N, 10);
+
+  if (Digits < SIQSDigits || Digits > SIQSMaxDigits)
+    return PollardPM1(F, N) || PollardBrent(F, N) || ECM(F, N, ECMDigits);
 
-  if (K > 0)
-    Factors.insert(new MPZ(NL, NumBits));
+  uint32_t ED = std::min(ECMDigits, Digits * 3U / 10U);
+  return PollardPM1(F, N) || PollardBrent(F, N) || ECM(F, N, ED) ||
+    SIQS(F, N, Threads(), SIQSSeconds, Verbose);
+}
+
+// The cache value of a result: a p^e token for every prime factor,
+// ascending, and cC^e for a cofactor that could not be split.
+static void AppendFactorTokens(const factor_state& FS, std::vector<char>& B,
+                               std::string& Out) {
+  for (factor_set::const_iterator I = FS.Factors.begin();
+       I != FS.Factors.end(); ) {
+    factor_set::const_iterator J = I;
+    uint32_t E = 0U;
+
+    while (J != FS.Factors.end() && mpz_cmp((*J)->MP, (*I)->MP) == 0) {
+      ++J;
+      ++E;
+    }
+
+    if (!Out.empty())
+      Out += ' ';
+    if (FS.Composite && !IsProbablePrimeMP((*I)->MP, NumBits))
+      Out += 'c';
+
+    B.resize(mpz_sizeinbase((*I)->MP, 10) + 2UL);
+    Out += mpz_get_str(B.data(), 10, (*I)->MP);
+    Out += '^';
+    Out += std::to_string(E);
+    I = J;
+  }
+}
+
+typedef std::vector<std::pair<MPZ*, uint32_t>> factor_work;
+
+// Restores a cached result of N: the primes go to FS and the unsplit
+// cofactors to Work. Returns false, with FS and Work empty, if the value
+// does not multiply out to N.
+static bool RestoreFactors(const mpz_t& N, const std::string& V,
+                           factor_state& FS, factor_work& Work,
+                           unsigned NumBits) {
+  mpz_t P;
+  mpz_t Q;
+  mpz_init2(P, NumBits);
+  mpz_init2(Q, NumBits);
+  mpz_set_ui(Q, 1UL);
+
+  bool Ok = true;
+  size_t B = 0UL;
+
+  while (Ok && B < V.size()) {
+    size_t E = V.find(' ', B);
+    if (E == std::string::npos)
+      E = V.size();
+
+    std::string T = V.substr(B, E - B);
+    B = E + 1UL;
+
+    size_t C = T.find('^');
+    bool Composite = !T.empty() && T[0] == 'c';
+    unsigned long X = 0UL;
+
+    if (C == std::string::npos || C + 1UL == T.size() ||
+        T.find_first_not_of("0123456789", C + 1UL) != std::string::npos ||
+        (X = std::strtoul(T.c_str() + C + 1UL, NULL, 10)) == 0UL ||
+        mpz_set_str(P, T.substr(Composite ? 1UL : 0UL,
+                                C - (Composite ? 1UL : 0UL)).c_str(),
+                    10) != 0 || mpz_cmp_ui(P, 1UL) <= 0) {
+      Ok = false;
+      break;
+    }
+
+    if (Composite)
+      Work.push_back(std::make_pair(new MPZ(P, NumBits), (uint32_t) X));
+    else
+      FS.Insert(P, (uint32_t) X, NumBits);
+
+    for (unsigned long I = 0UL; I < X; ++I)
+      mpz_mul(Q, Q, P);
+  }
+
+  if (!Ok || mpz_cmp(Q, N) != 0) {
+    FS.Clear();
+    for (size_t I = 0UL; I < Work.size(); ++I)
+      delete Work[I].first;
+    Work.clear();
+    Ok = false;
+  }
 
   mpz_clear(Q);
-  mpz_clear(R);
-  mpz_clear(D);
-  mpz_clear(I);
-  mpz_clear(S);
-  mpz_clear(Z);
-  mpz_clear(NL);
+  mpz_clear(P);
+  return Ok;
 }
 
-static void Cleanup() {
-  for (std::multiset<MPZ*>::iterator I = Factors.begin();
-       I != Factors.end(); ++I)
-    delete *I;
+// The factoring pipeline. After the small factors, every cofactor goes
+// through the stages in order of cost until one of them splits it:
+// primality check, perfect power, p-1, Brent's rho, ECM, and the
+// quadratic sieve by size. Both parts of a split go back on the work list
+// with the exponent of the cofactor.
+//
+// With a cache, a cached result of N is used as it is, and a cached
+// partial result resumes with its unsplit cofactors. A result that took
+// any splitting work is added to the cache unless it is already there.
+static void PrimeFactors(const mpz_t& N, factor_state& FS, unsigned NumBits) {
+  mpz_t NL;
+  mpz_t F;
+  mpz_init2(NL, NumBits);
+  mpz_init2(F, NumBits);
+
+  factor_work Work;
+  std::string Cached;
+  bool Hit = Cache && mpz_cmp_ui(N, 1UL) > 0 && Cache->Find(N, Cached) &&
+    RestoreFactors(N, Cached, FS, Work, NumBits);
+
+  if (!Hit) {
+    mpz_set(NL, N);
+    SmallFactors(NL, FS, NumBits);
+
+    if (mpz_cmp_ui(NL, 1UL) > 0)
+      Work.push_back(std::make_pair(new MPZ(NL, NumBits), 1U));
+  }
+
+  bool Worked = false;
+
+  while (!Work.empty()) {
+    MPZ* C = Work.back().first;
+    uint32_t E = Work.back().second;
+    Work.pop_back();
+
+    uint32_t K;
+
+    if (IsProbablePrimeMP(C->MP, NumBits)) {
+      FS.Insert(C->MP, E, NumBits);
+    } else if ((K = PerfectPower(F, C->MP)) > 1U) {
+      Work.push_back(std::make_pair(new MPZ(F, NumBits), E * K));
+    } else if (Split(F, C->MP)) {
+      Work.push_back(std::make_pair(new MPZ(F, NumBits), E));
+      mpz_divexact(F, C->MP, F);
+      Work.push_back(std::make_pair(new MPZ(F, NumBits), E));
+      Worked = true;
+    } else {
+      Worked = true;
+      if (Verbose)
+        std::cerr << "Warning: " << C->AsString() << " is composite, but "
+          << "could not be factored within the bounds." << std::endl;
+      FS.Insert(C->MP, E, NumBits);
+      FS.Composite = true;
+    }
+
+    delete C;
+  }
+
+  if (Cache && Worked) {
+    std::vector<char> B;
+    std::string V;
+    AppendFactorTokens(FS, B, V);
+
+    if (V != Cached && !Cache->Insert(N, V) && Verbose)
+      std::cerr << "Warning: Could not write to the factorization cache: "
+        << strerror(errno) << std::endl;
+  }
+
+  mpz_clear(F);
+  mpz_clear(NL);
 }
 
 static void PrintUsage() {
   std::cerr << "Usage: primefactorsmp -b <number-of-bits> <unsigned integer>"
     << std::endl;
+  std::cerr << "                      [ -B <small-prime-bound> "
+    << "(default 1048576, 0 = off)]" << std::endl;
+  std::cerr << "                      [ -1 <p-1-stage-1-bound> (default 50000)]"
+    << std::endl;
+  std::cerr << "                      [ -2 <p-1-stage-2-bound> "
+    << "(default 100 * B1)]" << std::endl;
+  std::cerr << "                      [ -R <rho-iterations> (default 2^30)]"
+    << std::endl;
+  std::cerr << "                      [ -E <ECM-digit-level> (default 50)]"
+    << std::endl;
+  std::cerr << "                      [ -Q <SIQS-min-digits> (default 40)]"
+    << std::endl;
+  std::cerr << "                      [ -T <ECM/SIQS/batch-threads> "
+    << "(default all CPUs)]" << std::endl;
+  std::cerr << "                      [ -L pm1|rho|ecm|siqs=<seconds> "
+    << "(stage time budget," << std::endl;
+  std::cerr << "                         default pm1=2, rho=1, ecm=600, "
+    << "siqs=3600)]" << std::endl;
+  std::cerr << "                      [ -C <cache-file> (persistent "
+    << "factorization cache)]" << std::endl;
+  std::cerr << "       primefactorsmp -b <number-of-bits> -f <file> (- = stdin) "
+    << "[ options ]" << std::endl;
 }
 
-static void PrintFactors(const mpz_t& N) {
+// -L <stage>=<seconds>.
+static bool ParseBudget(const char* S) {
+  const char* EQ = std::strchr(S, '=');
+  if (EQ == NULL)
+    return false;
+
+  std::string Stage(S, EQ - S);
+  char* E;
+  double Seconds = std::strtod(EQ + 1, &E);
+
+  if (*E != '\0' || E == EQ + 1 || Seconds < 0.0)
+    return false;
+
+  if (Stage == "pm1")
+    PM1Seconds = Seconds;
+  else if (Stage == "rho")
+    RhoSeconds = Seconds;
+  else if (Stage == "ecm")
+    ECMSeconds = Seconds;
+  else if (Stage == "siqs")
+    SIQSSeconds = Seconds;
+  else
+    return false;
+
+  return true;
+}
+
+static void PrintFactors(const mpz_t& N, const factor_state& FS) {
   MPZ* NS = new MPZ(N, NumBits);
   std::cout << "Prime Factors of " << NS->AsString() << ":";
 
   std::map<MPZ*, uint32_t, mpz_less<MPZ*>> FM;
   std::string SR;
 
-  for (std::multiset<MPZ*>::iterator I = Factors.begin();
-       I != Factors.end(); ++I) {
+  for (factor_set::const_iterator I = FS.Factors.begin();
+       I != FS.Factors.end(); ++I) {
     if (!(FM.insert(std::make_pair(*I, 1U)).second)) {
       std::map<MPZ*, uint32_t>::iterator MI = FM.find(*I);
       (*MI).second++;
@@ -243,19 +1454,138 @@ static void PrintFactors(const mpz_t& N) {
   delete NS;
 }
 
+// One line of batch output: N followed by a p^e token for every prime
+// factor, ascending. A cofactor that could not be split is written as
+// cN^e.
+static void FormatFactors(const mpz_t& N, const factor_state& FS,
+                          std::vector<char>& B, std::string& Out) {
+  std::string T;
+  AppendFactorTokens(FS, B, T);
+
+  B.resize(mpz_sizeinbase(N, 10) + 2UL);
+  Out = mpz_get_str(B.data(), 10, N);
+
+  if (!T.empty()) {
+    Out += ' ';
+    Out += T;
+  }
+}
+
+// Per-thread state of the batch mode.
+struct factor_worker {
+  factor_worker() : FS(), B() {
+    mpz_init2(N, NumBits);
+  }
+
+  ~factor_worker() {
+    mpz_clear(N);
+  }
+
+  void operator()(const std::string& In, std::string& Out) {
+    size_t B0 = In.find_first_not_of(" \t");
+    size_t E0 = In.find_last_not_of(" \t\r");
+    std::string S = B0 == std::string::npos ? std::string() :
+      In.substr(B0, E0 - B0 + 1UL);
+
+    if (S.empty() || S.find_first_not_of("0123456789") != std::string::npos ||
+        mpz_set_str(N, S.c_str(), 10) != 0 ||
+        mpz_sizeinbase(N, 2) > NumBits) {
+      Out = S + " invalid";
+      return;
+    }
+
+    FS.Clear();
+    if (mpz_cmp_ui(N, 1UL) > 0)
+      PrimeFactors(N, FS, NumBits);
+    if (FS.Composite)
+      Incomplete.store(true, std::memory_order_relaxed);
+    FormatFactors(N, FS, B, Out);
+  }
+
+  mpz_t N;
+  factor_state FS;
+  std::vector<char> B;
+};
+
+// Factors every number of the file (one per line) on a pool of -T
+// workers and writes one line of p^e tokens per input line, in input
+// order. Returns 2 if any number could not be factored completely.
+static int BatchFactors(const char* Path) {
+  std::ifstream F;
+  std::istream* In = &std::cin;
+
+  if (std::strcmp(Path, "-") != 0) {
+    F.open(Path);
+    if (!F) {
+      std::cerr << "Error: Could not open " << Path << ": "
+        << strerror(errno) << std::endl;
+      return 1;
+    }
+
+    In = &F;
+  }
+
+  uint32_t NT = Threads();
+  StageThreads = 1U;
+  Verbose = false;
+
+  std::ios::sync_with_stdio(false);
+
+  BatchPool<factor_worker> Pool(NT);
+  (void) Pool.Run(*In, stdout);
+
+  return Incomplete.load() ? 2 : 0;
+}
+
 int main(int argc, char* argv[])
 {
-  if (argc != 4) {
+  if (argc < 4) {
     PrintUsage();
     return 1;
   }
 
   int c;
+  const char* Path = NULL;
+
+  const char* CachePath = NULL;
 
-  while ((c = getopt(argc, argv, "hb:")) != -1) {
+  while ((c = getopt(argc, argv, "hb:B:1:2:R:L:E:Q:T:f:C:")) != -1) {
     switch (c) {
+    case 'C':
+      CachePath = optarg;
+      break;
     case 'b':
-      NumBits = (unsigned) std::stoul(argv[2]);
+      NumBits = (unsigned) std::stoul(optarg);
+      break;
+    case 'B':
+      PrimeBound = (uint32_t) std::stoul(optarg);
+      break;
+    case '1':
+      PM1B1 = (uint64_t) std::stoull(optarg);
+      break;
+    case '2':
+      PM1B2 = (uint64_t) std::stoull(optarg);
+      break;
+    case 'R':
+      RhoIterations = (uint64_t) std::stoull(optarg);
+      break;
+    case 'E':
+      ECMDigits = (uint32_t) std::stoul(optarg);
+      break;
+    case 'f':
+      Path = optarg;
+      break;
+    case 'Q':
+      SIQSDigits = (uint32_t) std::stoul(optarg);
+      break;
+    case 'T':
+      NThreads = (uint32_t) std::stoul(optarg);
+      break;
+    case 'L':
+      if (!ParseBudget(optarg)) {
+        PrintUsage();
+        return 1;
+      }
       break;
     case 'h':
       PrintUsage();
@@ -273,6 +1603,42 @@ int main(int argc, char* argv[])
     return 1;
   }
 
+  if (optind != argc - (Path ? 0 : 1)) {
+    PrintUsage();
+    return 1;
+  }
+
+  if (PrimeBound > SmallPrimeLimit) {
+    SievePrimes(PrimeBound, SmallPrimes);
+    SmallPrimes.erase(SmallPrimes.begin(),
+                      std::lower_bound(SmallPrimes.begin(), SmallPrimes.end(),
+                                       SmallPrimeLimit));
+    SmallPrimeTree.Build(SmallPrimes);
+  }
+
+  uint64_t B2 = PM1B2 ? PM1B2 : 100UL * PM1B1;
+  if (B2 < PM1B1 || B2 > 0xffffffffUL) {
+    std::cerr << "Error: Invalid p-1 stage 2 bound!" << std::endl;
+    return 1;
+  }
+
+  SievePrimes((uint32_t) B2, StagePrimes);
+
+  FactorCache FC;
+  if (CachePath) {
+    if (!FC.Open(CachePath)) {
+      std::cerr << "Error: Could not open the factorization cache "
+        << CachePath << ": " << (errno ? strerror(errno) : "Invalid cache")
+        << '!' << std::endl;
+      return 1;
+    }
+
+    Cache = &FC;
+  }
+
+  if (Path)
+    return BatchFactors(Path);
+
   mpz_t N;
   mpz_init2(N, NumBits);
 
@@ -282,14 +1648,16 @@ int main(int argc, char* argv[])
     return 1;
   }
 
+  factor_state FS;
+
   Timestamp(&tp_start);
-  PrimeFactors(N, NumBits);
+  PrimeFactors(N, FS, NumBits);
   Timestamp(&tp_end);
 
-  PrintFactors(N);
+  PrintFactors(N, FS);
   PrintTimediff(&tp_start, &tp_end);
-  Cleanup();
+  mpz_clear(N);
 
-  return 0;
+  return FS.Composite ? 2 : 0;
 }
 
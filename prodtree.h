@@ -0,0 +1,264 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#ifndef PRODTREE_H
+#define PRODTREE_H
+
+#include <vector>
+#include <cstdint>
+#include <gmp.h>
+
+// Batch small-factor screening with product and remainder trees
+// (D. J. Bernstein, "How to find smooth parts of integers"). Reducing
+// the primorial of the sieving primes modulo every candidate through a
+// remainder tree costs quasi-linear time in the total size of the batch,
+// instead of one division per (candidate, prime) pair.
+
+// Odd-only sieve of Eratosthenes: all primes <= Limit, ascending.
+static inline void SievePrimes(uint32_t Limit, std::vector<uint32_t>& Primes) {
+  Primes.clear();
+
+  if (Limit < 2U)
+    return;
+
+  Primes.push_back(2U);
+
+  // Index I stands for 2 * I + 1.
+  size_t S = ((size_t) Limit - 1UL) / 2UL + 1UL;
+  std::vector<bool> C(S, false);
+
+  for (size_t I = 1UL; (2UL * I + 1UL) * (2UL * I + 1UL) <= Limit; ++I) {
+    if (C[I])
+      continue;
+
+    size_t P = 2UL * I + 1UL;
+    for (size_t J = P * P / 2UL; J < S; J += P)
+      C[J] = true;
+  }
+
+  for (size_t I = 1UL; I < S; ++I) {
+    if (!C[I])
+      Primes.push_back((uint32_t) (2UL * I + 1UL));
+  }
+}
+
+// A product tree over N leaves. Level 0 holds the leaves, every level
+// above holds the pairwise products of the one below, and the last level
+// is the root. The mpz_t's are kept across Build() calls, so a tree can
+// serve as per-thread scratch storage for any number of batches.
+class ProductTree {
+public:
+  ProductTree() : Levels(), Rems(), Sizes(), Alloc(), Height(0UL) { }
+
+  ~ProductTree() {
+    for (size_t K = 0UL; K < Levels.size(); ++K) {
+      for (size_t I = 0UL; I < Alloc[K]; ++I) {
+        mpz_clear(Levels[K][I]);
+        mpz_clear(Rems[K][I]);
+      }
+
+      delete [] Levels[K];
+      delete [] Rems[K];
+    }
+  }
+
+  void Build(const mpz_t* X, size_t N) {
+    Shape(N);
+
+    for (size_t I = 0UL; I < N; ++I)
+      mpz_set(Levels[0][I], X[I]);
+
+    Multiply();
+  }
+
+  void Build(const std::vector<uint32_t>& X) {
+    Shape(X.size());
+
+    for (size_t I = 0UL; I < X.size(); ++I)
+      mpz_set_ui(Levels[0][I], X[I]);
+
+    Multiply();
+  }
+
+  inline size_t Leaves() const {
+    return Sizes.empty() ? 0UL : Sizes[0];
+  }
+
+  inline const mpz_t& Root() const {
+    return Levels[Height - 1UL][0];
+  }
+
+  inline const mpz_t& Leaf(size_t I) const {
+    return Levels[0][I];
+  }
+
+  // R[I] = V mod leaf I, for every leaf. A zero leaf (and every product
+  // above it) leaves the remainder as it is, as V mod 0 = V, so that
+  // gcd(R[I], 0) is still gcd(V, 0).
+  void Remainders(const mpz_t& V, mpz_t* R) {
+    size_t T = Height - 1UL;
+    Mod(T == 0UL ? R[0] : Rems[T][0], V, Levels[T][0]);
+
+    for (size_t K = T; K-- > 0UL; ) {
+      mpz_t* D = K == 0UL ? R : Rems[K];
+
+      for (size_t I = 0UL; I < Sizes[K]; ++I)
+        Mod(D[I], Rems[K + 1UL][I / 2UL], Levels[K][I]);
+    }
+  }
+
+  // Indices of the leaves that share a factor with V, ascending. The
+  // descent only enters subtrees whose product shares a factor with V.
+  void CommonFactors(const mpz_t& V, std::vector<size_t>& Idx) {
+    Idx.clear();
+
+    if (Height == 0UL)
+      return;
+
+    mpz_t G;
+    mpz_init(G);
+    mpz_gcd(G, V, Levels[Height - 1UL][0]);
+
+    if (mpz_cmp_ui(G, 1UL) != 0)
+      Descend(G, Height - 1UL, 0UL, Idx);
+
+    mpz_clear(G);
+  }
+
+private:
+  ProductTree(const ProductTree&) = delete;
+  ProductTree& operator=(const ProductTree&) = delete;
+
+  void Shape(size_t N) {
+    Sizes.clear();
+
+    size_t S = N ? N : 1UL;
+    for (;;) {
+      Sizes.push_back(S);
+      if (S == 1UL)
+        break;
+
+      S = (S + 1UL) / 2UL;
+    }
+
+    Height = Sizes.size();
+
+    for (size_t K = 0UL; K < Height; ++K) {
+      if (K == Levels.size()) {
+        Levels.push_back(NULL);
+        Rems.push_back(NULL);
+        Alloc.push_back(0UL);
+      }
+
+      if (Alloc[K] >= Sizes[K])
+        continue;
+
+      mpz_t* L = new mpz_t[Sizes[K]];
+      mpz_t* R = new mpz_t[Sizes[K]];
+
+      for (size_t I = 0UL; I < Sizes[K]; ++I) {
+        if (I < Alloc[K]) {
+          mpz_init_set(L[I], Levels[K][I]);
+          mpz_init_set(R[I], Rems[K][I]);
+          mpz_clear(Levels[K][I]);
+          mpz_clear(Rems[K][I]);
+        } else {
+          mpz_init(L[I]);
+          mpz_init(R[I]);
+        }
+      }
+
+      delete [] Levels[K];
+      delete [] Rems[K];
+      Levels[K] = L;
+      Rems[K] = R;
+      Alloc[K] = Sizes[K];
+    }
+
+    if (N == 0UL)
+      mpz_set_ui(Levels[0][0], 1UL);
+  }
+
+  static inline void Mod(mpz_t& R, const mpz_t& V, const mpz_t& M) {
+    if (mpz_sgn(M) == 0)
+      mpz_set(R, V);
+    else
+      mpz_mod(R, V, M);
+  }
+
+  void Multiply() {
+    for (size_t K = 1UL; K < Height; ++K) {
+      for (size_t I = 0UL; I < Sizes[K]; ++I) {
+        if (2UL * I + 1UL < Sizes[K - 1UL])
+          mpz_mul(Levels[K][I], Levels[K - 1UL][2UL * I],
+                  Levels[K - 1UL][2UL * I + 1UL]);
+        else
+          mpz_set(Levels[K][I], Levels[K - 1UL][2UL * I]);
+      }
+    }
+  }
+
+  void Descend(const mpz_t& G, size_t K, size_t I, std::vector<size_t>& Idx) {
+    if (K == 0UL) {
+      Idx.push_back(I);
+      return;
+    }
+
+    mpz_t C;
+    mpz_init(C);
+
+    for (size_t J = 2UL * I; J < 2UL * I + 2UL && J < Sizes[K - 1UL]; ++J) {
+      mpz_gcd(C, G, Levels[K - 1UL][J]);
+
+      if (mpz_cmp_ui(C, 1UL) != 0)
+        Descend(C, K - 1UL, J, Idx);
+    }
+
+    mpz_clear(C);
+  }
+
+  std::vector<mpz_t*> Levels;
+  std::vector<mpz_t*> Rems;
+  std::vector<size_t> Sizes;
+  std::vector<size_t> Alloc;
+  size_t Height;
+};
+
+// Product of all the primes in Primes.
+static inline void Primorial(mpz_t& R, const std::vector<uint32_t>& Primes) {
+  ProductTree T;
+  T.Build(Primes);
+  mpz_set(R, T.Root());
+}
+
+// G[I] = gcd(X[I], P) for a batch of candidates, where P is the primorial
+// of the sieving primes. G[I] == 1 means that X[I] has no small factor;
+// G[I] == X[I] can also mean that X[I] is itself one of the small primes.
+// A zero X[I] gives G[I] = P.
+static inline void BatchSmallFactors(ProductTree& T, const mpz_t* X, size_t N,
+                                     const mpz_t& P, mpz_t* G) {
+  if (N == 0UL)
+    return;
+
+  T.Build(X, N);
+  T.Remainders(P, G);
+
+  for (size_t I = 0UL; I < N; ++I)
+    mpz_gcd(G[I], G[I], X[I]);
+}
+
+#endif // PRODTREE_H
@@ -0,0 +1,176 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#ifndef PROTH_H
+#define PROTH_H
+
+#include <cstdint>
+#include <gmp.h>
+
+// Deterministic tests for N = K * 2^E + 1 with a single word K.
+//
+// Proth: if K < 2^E and a^((N - 1) / 2) = -1 mod N for some a, then N
+// is prime; conversely, if N is prime this holds for every quadratic
+// non-residue a. Pepin's test of the Fermat number F(m) = 2^(2^m) + 1 is
+// the special case K = 1, E = 2^m, a = 3.
+//
+// Since 2^E = -1/K mod N, a product X = H * 2^E + L with H = Q * K + R
+// reduces to R * 2^E + L - Q: a shift, one division by a single word and
+// a subtraction. No multi-precision division or Montgomery conversion is
+// needed, so a modular squaring costs about as much as the square itself.
+
+class ProthModulus {
+public:
+  ProthModulus(uint64_t k, uint64_t e) : K(k), E(e) {
+    mpz_init(N);
+    mpz_init(H);
+    mpz_init(L);
+
+    mpz_set_ui(N, K);
+    mpz_mul_2exp(N, N, E);
+    mpz_add_ui(N, N, 1UL);
+  }
+
+  ~ProthModulus() {
+    mpz_clear(L);
+    mpz_clear(H);
+    mpz_clear(N);
+  }
+
+  inline const mpz_t& Modulus() const {
+    return N;
+  }
+
+  // X mod N, for 0 <= X < N^2.
+  void Reduce(mpz_t& X) {
+    mpz_tdiv_r_2exp(L, X, E);
+    mpz_tdiv_q_2exp(H, X, E);
+
+    if (K == 1UL) {
+      mpz_sub(X, L, H);
+    } else {
+      uint64_t R = mpz_tdiv_q_ui(H, H, K);
+      mpz_set_ui(X, R);
+      mpz_mul_2exp(X, X, E);
+      mpz_add(X, X, L);
+      mpz_sub(X, X, H);
+    }
+
+    while (mpz_sgn(X) < 0)
+      mpz_add(X, X, N);
+
+    while (mpz_cmp(X, N) >= 0)
+      mpz_sub(X, X, N);
+  }
+
+  inline void Square(mpz_t& X) {
+    mpz_mul(X, X, X);
+    Reduce(X);
+  }
+
+private:
+  ProthModulus(const ProthModulus&) = delete;
+  ProthModulus& operator=(const ProthModulus&) = delete;
+
+  uint64_t K;
+  uint64_t E;
+  mpz_t N;
+  mpz_t H;
+  mpz_t L;
+};
+
+enum proth_result {
+  ProthComposite,
+  ProthPrime,
+  ProthUnknown
+};
+
+// Proth test of K * 2^E + 1. A = 0 picks the smallest odd prime that is
+// a quadratic non-residue. ProthUnknown means the theorem does not apply
+// (K >= 2^E after moving the factors of two from K into E) or that no
+// non-residue below 256 exists; the caller should fall back to a generic
+// probable-prime test.
+static inline proth_result ProthTest(uint64_t K, uint64_t E, uint64_t A = 0UL) {
+  if (K == 0UL)
+    return ProthUnknown;
+
+  while (!(K & 1UL)) {
+    K >>= 1;
+    ++E;
+  }
+
+  if (E == 0UL || (E < 64UL && K >= (1UL << E)))
+    return ProthUnknown;
+
+  ProthModulus M(K, E);
+  const mpz_t& N = M.Modulus();
+
+  if (A == 0UL) {
+    static const uint64_t QP[] = {
+      3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67,
+      71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139,
+      149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+      227, 229, 233, 239, 241, 251
+    };
+
+    for (size_t I = 0UL; I < sizeof(QP) / sizeof(QP[0]); ++I) {
+      if (mpz_cmp_ui(N, QP[I]) == 0)
+        return ProthPrime;
+
+      int J = mpz_ui_kronecker(QP[I], N);
+      if (J == 0)
+        return ProthComposite;
+
+      if (J < 0) {
+        A = QP[I];
+        break;
+      }
+    }
+
+    if (A == 0UL)
+      return ProthUnknown;
+  } else if (mpz_cmp_ui(N, A) == 0) {
+    return ProthPrime;
+  }
+
+  mpz_t X;
+  mpz_init(X);
+
+  // a^((N - 1) / 2) = (a^K)^(2^(E - 1)).
+  mpz_set_ui(X, A);
+  mpz_powm_ui(X, X, K, N);
+
+  for (uint64_t I = 1UL; I < E; ++I)
+    M.Square(X);
+
+  mpz_add_ui(X, X, 1UL);
+  bool P = mpz_cmp(X, N) == 0;
+
+  mpz_clear(X);
+
+  return P ? ProthPrime : ProthComposite;
+}
+
+// Pepin's test of the Fermat number 2^(2^m) + 1, for m < 64.
+static inline bool PepinTest(uint32_t m) {
+  if (m == 0U)
+    return true;
+
+  return ProthTest(1UL, 1UL << m, 3UL) == ProthPrime;
+}
+
+#endif // PROTH_H
@@ -0,0 +1,1186 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+
+#include <pthread.h>
+#include <gmp.h>
+
+#include "siqs.h"
+#include "prodtree.h"
+
+// Sieve block size: the sieve array of one block stays in the L1 cache.
+static const uint32_t SIQSBlockSize = 32768U;
+
+// Factor base primes below this bound are not sieved; the threshold
+// allows for their missing contribution.
+static const uint32_t SIQSSmallPrime = 30U;
+
+// Bits below the size of Q(x), besides the large prime, at which a
+// sieve value becomes a candidate for trial division.
+static const double SIQSThresholdSlack = 18.0;
+
+// Relations wanted beyond the number of matrix columns.
+static const uint32_t SIQSExcess = 96U;
+
+// Weight-2 rows are not merged into relations heavier than this.
+static const size_t SIQSMergeWeight = 64UL;
+
+struct siqs_params {
+  uint32_t Digits;
+  uint32_t FBSize;
+  uint32_t Blocks;
+  uint32_t LPMult;
+};
+
+// Factor base size, blocks per side of the interval and large prime
+// bound (a multiple of the largest factor base prime), by digits of kN.
+// Sizes in between are interpolated.
+static const siqs_params SIQSParams[] = {
+  {  30U,    200U,  1U,  40U },
+  {  40U,    500U,  1U,  60U },
+  {  50U,   1400U,  1U,  80U },
+  {  60U,   3600U,  2U, 100U },
+  {  70U,   8500U,  3U, 120U },
+  {  80U,  17000U,  4U, 150U },
+  {  90U,  32000U,  6U, 200U },
+  { 100U,  50000U,  8U, 250U },
+  { 110U,  75000U, 10U, 250U },
+  { 125U, 110000U, 12U, 250U }
+};
+
+static const uint32_t SIQSMultipliers[] = {
+  1, 3, 5, 7, 11, 13, 15, 17, 19, 21, 23, 29, 31, 33, 35, 37, 39, 41, 43,
+  47, 51, 53, 55, 57, 59, 61, 65, 67, 69, 71, 73
+};
+
+static double MonotonicSeconds() {
+  struct timespec TS;
+  (void) clock_gettime(CLOCK_MONOTONIC, &TS);
+  return (double) TS.tv_sec + (double) TS.tv_nsec / 1.0e9;
+}
+
+static inline uint32_t PowMod32(uint64_t B, uint64_t E, uint32_t P) {
+  uint64_t R = 1UL;
+  B %= P;
+
+  while (E) {
+    if (E & 1UL)
+      R = R * B % P;
+    B = B * B % P;
+    E >>= 1;
+  }
+
+  return (uint32_t) R;
+}
+
+// A^-1 mod P, for gcd(A, P) = 1.
+static inline uint32_t InvMod32(uint32_t A, uint32_t P) {
+  int64_t T = 0L;
+  int64_t NT = 1L;
+  int64_t R = P;
+  int64_t NR = A % P;
+
+  while (NR) {
+    int64_t Q = R / NR;
+    int64_t X = T - Q * NT;
+    T = NT;
+    NT = X;
+    X = R - Q * NR;
+    R = NR;
+    NR = X;
+  }
+
+  return (uint32_t) (T < 0L ? T + P : T);
+}
+
+// Tonelli-Shanks: a square root of the quadratic residue A mod the odd
+// prime P.
+static uint32_t SqrtMod32(uint32_t A, uint32_t P) {
+  A %= P;
+  if (A == 0U)
+    return 0U;
+
+  if ((P & 3U) == 3U)
+    return PowMod32(A, (P + 1U) / 4U, P);
+
+  uint32_t Q = P - 1U;
+  uint32_t S = 0U;
+  while (!(Q & 1U)) {
+    Q >>= 1;
+    ++S;
+  }
+
+  uint32_t Z = 2U;
+  while (PowMod32(Z, (P - 1U) / 2U, P) != P - 1U)
+    ++Z;
+
+  uint64_t C = PowMod32(Z, Q, P);
+  uint64_t R = PowMod32(A, (Q + 1U) / 2U, P);
+  uint64_t T = PowMod32(A, Q, P);
+  uint32_t M = S;
+
+  while (T != 1UL) {
+    uint32_t I = 0U;
+    uint64_t TT = T;
+    while (TT != 1UL) {
+      TT = TT * TT % P;
+      ++I;
+    }
+
+    uint64_t BB = C;
+    for (uint32_t J = 0U; J + I + 1U < M; ++J)
+      BB = BB * BB % P;
+
+    M = I;
+    C = BB * BB % P;
+    T = T * C % P;
+    R = R * BB % P;
+  }
+
+  return (uint32_t) R;
+}
+
+// A relation (Ax + B)^2 = Cols (mod N): Y = |Ax + B| mod N, the factor
+// base columns of A * Q(x) with multiplicity (column 0 is the sign) and
+// L, a factor of the square root that is not in the factor base (the
+// large prime of two combined partial relations, or 1).
+struct siqs_relation {
+  std::vector<mp_limb_t> Y;
+  std::vector<uint32_t> Cols;
+  uint64_t L;
+};
+
+static void StoreMPZ(std::vector<mp_limb_t>& V, const mpz_t& X) {
+  V.resize(mpz_size(X));
+
+  for (size_t I = 0UL; I < V.size(); ++I)
+    V[I] = mpz_getlimbn(X, I);
+}
+
+static void LoadMPZ(mpz_t& X, const std::vector<mp_limb_t>& V) {
+  mpz_import(X, V.size(), -1, sizeof(mp_limb_t), 0, 0, V.data());
+}
+
+struct siqs_job {
+  siqs_job() : Primes(), Sqrt(), Logp(), NoSieve(), K(1U), M(0U),
+    Blocks(0U), SieveStart(0U), LPMax(0UL), Init(0U), S(0U), QLo(0U),
+    QHi(0U), LogTarget(0.0), Rels(), Partials(), PartialIndex(), UsedA(),
+    Polys(0UL), Need(0UL), Seed(0x9e3779b97f4a7c15UL), Stop(false),
+    Deadline(0.0), Verbose(true) {
+    mpz_init(N);
+    mpz_init(KN);
+    (void) pthread_mutex_init(&Mutex, NULL);
+  }
+
+  ~siqs_job() {
+    (void) pthread_mutex_destroy(&Mutex);
+    mpz_clear(KN);
+    mpz_clear(N);
+  }
+
+  mpz_t N;
+  mpz_t KN;
+
+  // The factor base. Column I + 1 of the matrix is Primes[I].
+  std::vector<uint32_t> Primes;
+  std::vector<uint32_t> Sqrt;
+  std::vector<uint8_t> Logp;
+  std::vector<uint8_t> NoSieve;
+
+  uint32_t K;
+  uint32_t M;
+  uint32_t Blocks;
+  uint32_t SieveStart;
+  uint64_t LPMax;
+  uint8_t Init;
+
+  // A = q_1 * ... * q_S, with the q_i drawn from [QLo, QHi) and the
+  // product close to 2^LogTarget = sqrt(2kN) / M.
+  uint32_t S;
+  uint32_t QLo;
+  uint32_t QHi;
+  double LogTarget;
+
+  // Guarded by Mutex.
+  std::vector<siqs_relation> Rels;
+  std::vector<siqs_relation> Partials;
+  std::unordered_map<uint64_t, uint32_t> PartialIndex;
+  std::set<std::vector<uint32_t>> UsedA;
+  uint64_t Polys;
+  size_t Need;
+  uint64_t Seed;
+  pthread_mutex_t Mutex;
+
+  std::atomic<bool> Stop;
+  double Deadline;
+  bool Verbose;
+};
+
+// Knuth-Schroeppel: the multiplier k that maximizes the expected
+// contribution of the small primes to the values Q(x), less the growth
+// of kN.
+static uint32_t ChooseMultiplier(const mpz_t& N) {
+  std::vector<uint32_t> P;
+  SievePrimes(2000U, P);
+
+  uint32_t Best = 1U;
+  double BestScore = -1.0e30;
+
+  for (size_t I = 0UL; I < sizeof(SIQSMultipliers) /
+         sizeof(SIQSMultipliers[0]); ++I) {
+    uint32_t K = SIQSMultipliers[I];
+    double Score = -0.5 * std::log((double) K);
+
+    uint64_t R8 = (mpz_fdiv_ui(N, 8UL) * K) & 7UL;
+    if (R8 == 1UL)
+      Score += 2.0 * std::log(2.0);
+    else if (R8 == 5UL)
+      Score += std::log(2.0);
+    else
+      Score += 0.5 * std::log(2.0);
+
+    for (size_t J = 1UL; J < P.size(); ++J) {
+      uint32_t Q = P[J];
+      double LQ = std::log((double) Q);
+
+      if (K % Q == 0U) {
+        Score += LQ / Q;
+      } else {
+        uint64_t R = mpz_fdiv_ui(N, Q) * K % Q;
+        if (R && PowMod32(R, (Q - 1U) / 2U, Q) == 1U)
+          Score += 2.0 * LQ / (Q - 1U);
+      }
+    }
+
+    if (Score > BestScore) {
+      BestScore = Score;
+      Best = K;
+    }
+  }
+
+  return Best;
+}
+
+// Builds the factor base of kN. Returns false and sets F if a factor
+// base candidate divides N.
+static bool BuildFactorBase(siqs_job& Job, uint32_t Size, mpz_t& F) {
+  std::vector<uint32_t> P;
+  uint32_t Limit = std::max(1000U, Size * 24U);
+
+  for (;;) {
+    SievePrimes(Limit, P);
+
+    Job.Primes.clear();
+    Job.Sqrt.clear();
+
+    for (size_t I = 0UL; I < P.size() && Job.Primes.size() < Size; ++I) {
+      uint32_t Q = P[I];
+
+      if (Q == 2U) {
+        Job.Primes.push_back(2U);
+        Job.Sqrt.push_back(1U);
+        continue;
+      }
+
+      uint32_t NR = (uint32_t) mpz_fdiv_ui(Job.N, Q);
+      if (NR == 0U) {
+        if (mpz_cmp_ui(Job.N, Q) != 0) {
+          mpz_set_ui(F, Q);
+          return false;
+        }
+        continue;
+      }
+
+      uint32_t R = (uint32_t) ((uint64_t) NR * Job.K % Q);
+
+      if (R == 0U) {
+        Job.Primes.push_back(Q);
+        Job.Sqrt.push_back(0U);
+      } else if (PowMod32(R, (Q - 1U) / 2U, Q) == 1U) {
+        Job.Primes.push_back(Q);
+        Job.Sqrt.push_back(SqrtMod32(R, Q));
+      }
+    }
+
+    if (Job.Primes.size() >= Size)
+      return true;
+
+    Limit *= 2U;
+  }
+}
+
+// Picks the number S of primes in A and the range they are drawn from.
+static void ChooseAShape(siqs_job& Job) {
+  const std::vector<uint32_t>& P = Job.Primes;
+  uint32_t FB = (uint32_t) P.size();
+
+  // The q_i should be a few thousand, well inside the factor base, and
+  // there should be enough of them for 2^(S - 1) polynomials per A.
+  double LogQ = std::log2(std::min(2000.0, (double) P[FB * 2U / 3U]));
+  uint32_t S = (uint32_t) (Job.LogTarget / LogQ + 0.5);
+  if (S < 3U)
+    S = 3U;
+
+  for (;;) {
+    double Q0 = std::exp2(Job.LogTarget / S);
+    uint32_t I0 = (uint32_t) (std::lower_bound(P.begin(), P.end(),
+                                               (uint32_t) Q0) - P.begin());
+    if (I0 >= FB - 1U && S < 20U) {
+      ++S;
+      continue;
+    }
+
+    if (I0 < Job.SieveStart && S > 3U) {
+      --S;
+      continue;
+    }
+
+    uint32_t W = std::max(2U * S + 8U, 24U);
+    Job.QLo = I0 > W ? I0 - W : 0U;
+    Job.QHi = std::min(FB, I0 + W);
+    if (Job.QLo < Job.SieveStart)
+      Job.QLo = Job.SieveStart;
+    if (Job.QHi < Job.QLo + 2U * S)
+      Job.QHi = std::min(FB, Job.QLo + 2U * S);
+    break;
+  }
+
+  Job.S = S;
+}
+
+static inline uint64_t NextRandom(uint64_t& X) {
+  X ^= X << 13;
+  X ^= X >> 7;
+  X ^= X << 17;
+  return X;
+}
+
+// One thread's polynomial state and sieve storage.
+class SIQSWorker {
+public:
+  explicit SIQSWorker(siqs_job& J) : Job(J), BJ(new mpz_t[J.S]), Q(), Sgn(),
+    Root1(), Root2(), Next1(), Next2(), AInv(), Bainv(),
+    NoSieve(J.NoSieve), Sieve(SIQSBlockSize), Found(), Rng(0UL) {
+    size_t FB = Job.Primes.size();
+    Root1.resize(FB);
+    Root2.resize(FB);
+    Next1.resize(FB);
+    Next2.resize(FB);
+    AInv.resize(FB);
+
+    mpz_init(A);
+    mpz_init(B);
+    mpz_init(C);
+    mpz_init(T);
+    mpz_init(V);
+    mpz_init(Y);
+
+    for (size_t I = 0UL; I < Job.S; ++I)
+      mpz_init(BJ[I]);
+
+    pthread_mutex_lock(&Job.Mutex);
+    Rng = NextRandom(Job.Seed);
+    pthread_mutex_unlock(&Job.Mutex);
+  }
+
+  ~SIQSWorker() {
+    for (size_t I = 0UL; I < Job.S; ++I)
+      mpz_clear(BJ[I]);
+
+    delete [] BJ;
+
+    mpz_clear(Y);
+    mpz_clear(V);
+    mpz_clear(T);
+    mpz_clear(C);
+    mpz_clear(B);
+    mpz_clear(A);
+  }
+
+  void Run() {
+    while (!Job.Stop.load(std::memory_order_relaxed)) {
+      if (MonotonicSeconds() > Job.Deadline) {
+        Job.Stop.store(true);
+        break;
+      }
+
+      if (!NewA())
+        continue;
+
+      uint32_t NP = 1U << (Job.S - 1U);
+
+      for (uint32_t I = 0U; I < NP; ++I) {
+        if (I > 0U)
+          NextB(I);
+
+        SievePolynomial();
+
+        if (Publish())
+          break;
+      }
+
+      for (size_t J = 0UL; J < Q.size(); ++J)
+        NoSieve[Q[J]] = Job.NoSieve[Q[J]];
+    }
+  }
+
+private:
+  SIQSWorker(const SIQSWorker&) = delete;
+  SIQSWorker& operator=(const SIQSWorker&) = delete;
+
+  // Draws a new A and sets up B, C and the roots of its first
+  // polynomial. Returns false if this A was used before.
+  bool NewA() {
+    const std::vector<uint32_t>& P = Job.Primes;
+    uint32_t S = Job.S;
+    uint32_t R = Job.QHi - Job.QLo;
+
+    Q.clear();
+    double LogA = 0.0;
+
+    while (Q.size() + 1U < S) {
+      uint32_t I = Job.QLo + (uint32_t) (NextRandom(Rng) % R);
+
+      if (Job.NoSieve[I] || std::find(Q.begin(), Q.end(), I) != Q.end())
+        continue;
+
+      Q.push_back(I);
+      LogA += std::log2((double) P[I]);
+    }
+
+    // The last q brings A as close to the target as the factor base
+    // allows.
+    double Want = std::exp2(Job.LogTarget - LogA);
+    uint32_t IB = (uint32_t) (std::lower_bound(P.begin(), P.end(),
+                                               (uint32_t) std::min(Want,
+                                                 4.0e9)) - P.begin());
+    uint32_t Best = ~0U;
+    double BestD = 1.0e30;
+
+    for (uint32_t I = IB > 8U ? IB - 8U : 0U;
+         I < std::min((uint32_t) P.size(), IB + 8U); ++I) {
+      if (I < Job.SieveStart || Job.NoSieve[I] ||
+          std::find(Q.begin(), Q.end(), I) != Q.end())
+        continue;
+
+      double D = std::fabs(std::log2((double) P[I]) - std::log2(Want));
+      if (D < BestD) {
+        BestD = D;
+        Best = I;
+      }
+    }
+
+    if (Best == ~0U)
+      return false;
+
+    Q.push_back(Best);
+    std::sort(Q.begin(), Q.end());
+
+    pthread_mutex_lock(&Job.Mutex);
+    bool Fresh = Job.UsedA.insert(Q).second;
+    pthread_mutex_unlock(&Job.Mutex);
+
+    if (!Fresh)
+      return false;
+
+    mpz_set_ui(A, 1UL);
+    for (size_t J = 0UL; J < S; ++J)
+      mpz_mul_ui(A, A, P[Q[J]]);
+
+    // B_j = (A / q_j) * gamma_j, gamma_j = sqrt(kN) * (A / q_j)^-1 mod
+    // q_j, so that B = sum B_j satisfies B^2 = kN (mod A).
+    mpz_set_ui(B, 0UL);
+
+    for (size_t J = 0UL; J < S; ++J) {
+      uint32_t QJ = P[Q[J]];
+      mpz_divexact_ui(T, A, QJ);
+      uint32_t G = (uint32_t) ((uint64_t) Job.Sqrt[Q[J]] *
+                               InvMod32((uint32_t) mpz_fdiv_ui(T, QJ), QJ) %
+                               QJ);
+      if (G > QJ / 2U)
+        G = QJ - G;
+
+      mpz_mul_ui(BJ[J], T, G);
+      mpz_add(B, B, BJ[J]);
+      NoSieve[Q[J]] = 1U;
+    }
+
+    Sgn.assign(S, 1);
+    ComputeC();
+
+    // Per-prime setup of the first polynomial, and 2 B_j A^-1 mod p for
+    // the Gray code steps.
+    size_t FB = P.size();
+    Bainv.resize((size_t) S * FB);
+
+    for (size_t I = 1UL; I < FB; ++I) {
+      uint32_t PI = P[I];
+
+      if (NoSieve[I] || Job.Sqrt[I] == 0U) {
+        Root1[I] = Root2[I] = ~0U;
+        continue;
+      }
+
+      uint32_t AI = InvMod32((uint32_t) mpz_fdiv_ui(A, PI), PI);
+      AInv[I] = AI;
+
+      for (size_t J = 0UL; J < S; ++J) {
+        uint64_t BM = mpz_fdiv_ui(BJ[J], PI);
+        Bainv[J * FB + I] = (uint32_t) (2UL * BM % PI * AI % PI);
+      }
+
+      uint64_t BP = mpz_fdiv_ui(B, PI);
+      uint64_t MP = Job.M % PI;
+      uint64_t SQ = Job.Sqrt[I];
+
+      Root1[I] = (uint32_t) (((SQ + PI - BP) % PI * AI + MP) % PI);
+      Root2[I] = (uint32_t) (((2UL * PI - SQ - BP) % PI * AI + MP) % PI);
+    }
+
+    return true;
+  }
+
+  // Moves to polynomial I of the current A: B += 2 e B_v with v the
+  // lowest set bit of I, and every root moves by -e 2 B_v A^-1 mod p.
+  void NextB(uint32_t I) {
+    uint32_t Vb = (uint32_t) __builtin_ctz(I);
+    int E = -Sgn[Vb];
+    Sgn[Vb] = E;
+
+    if (E > 0)
+      mpz_addmul_ui(B, BJ[Vb], 2UL);
+    else
+      mpz_submul_ui(B, BJ[Vb], 2UL);
+
+    ComputeC();
+
+    const std::vector<uint32_t>& P = Job.Primes;
+    size_t FB = P.size();
+    const uint32_t* BI = &Bainv[Vb * FB];
+
+    for (size_t J = 1UL; J < FB; ++J) {
+      if (Root1[J] == ~0U)
+        continue;
+
+      uint32_t PJ = P[J];
+      uint32_t D = BI[J];
+
+      if (E > 0) {
+        Root1[J] = Root1[J] >= D ? Root1[J] - D : Root1[J] + PJ - D;
+        Root2[J] = Root2[J] >= D ? Root2[J] - D : Root2[J] + PJ - D;
+      } else {
+        Root1[J] += D;
+        if (Root1[J] >= PJ)
+          Root1[J] -= PJ;
+        Root2[J] += D;
+        if (Root2[J] >= PJ)
+          Root2[J] -= PJ;
+      }
+    }
+  }
+
+  // C = (B^2 - kN) / A.
+  void ComputeC() {
+    mpz_mul(C, B, B);
+    mpz_sub(C, C, Job.KN);
+    mpz_divexact(C, C, A);
+  }
+
+  void SievePolynomial() {
+    const std::vector<uint32_t>& P = Job.Primes;
+    const std::vector<uint8_t>& LP = Job.Logp;
+    size_t FB = P.size();
+    uint32_t BS = SIQSBlockSize;
+
+    for (size_t I = Job.SieveStart; I < FB; ++I) {
+      Next1[I] = Root1[I];
+      Next2[I] = Root2[I];
+    }
+
+    for (uint32_t Blk = 0U; Blk < 2U * Job.Blocks; ++Blk) {
+      uint8_t* SA = Sieve.data();
+      std::memset(SA, Job.Init, BS);
+
+      for (size_t I = Job.SieveStart; I < FB; ++I) {
+        if (Root1[I] == ~0U)
+          continue;
+
+        uint32_t PI = P[I];
+        uint8_t L = LP[I];
+        uint32_t N1 = Next1[I];
+        uint32_t N2 = Next2[I];
+
+        while (N1 < BS) {
+          SA[N1] += L;
+          N1 += PI;
+        }
+
+        while (N2 < BS) {
+          SA[N2] += L;
+          N2 += PI;
+        }
+
+        Next1[I] = N1 - BS;
+        Next2[I] = N2 - BS;
+      }
+
+      // A relation candidate has the high bit of its byte set.
+      for (uint32_t W = 0U; W < BS / 8U; ++W) {
+        uint64_t SW;
+        std::memcpy(&SW, SA + W * 8U, sizeof(SW));
+        if (!(SW & 0x8080808080808080UL))
+          continue;
+
+        for (uint32_t J = 0U; J < 8U; ++J) {
+          if (SA[W * 8U + J] & 0x80U)
+            Check(Blk * BS + W * 8U + J);
+        }
+      }
+    }
+  }
+
+  // Trial-divides Q(x) at sieve index Idx (x = Idx - M) and queues it
+  // as a full or partial relation.
+  void Check(uint32_t Idx) {
+    const std::vector<uint32_t>& P = Job.Primes;
+    size_t FB = P.size();
+    long X = (long) Idx - (long) Job.M;
+
+    // V = (A x + 2 B) x + C = Q(x).
+    mpz_mul_si(V, A, X);
+    mpz_addmul_ui(V, B, 2UL);
+    mpz_mul_si(V, V, X);
+    mpz_add(V, V, C);
+
+    siqs_relation R;
+    R.L = 1UL;
+
+    if (mpz_sgn(V) < 0) {
+      R.Cols.push_back(0U);
+      mpz_neg(V, V);
+    } else if (mpz_sgn(V) == 0) {
+      return;
+    }
+
+    // A * Q(x) is the square of A x + B mod N.
+    for (size_t J = 0UL; J < Q.size(); ++J)
+      R.Cols.push_back(Q[J] + 1U);
+
+    mp_bitcnt_t Z = mpz_scan1(V, 0UL);
+    if (Z) {
+      mpz_tdiv_q_2exp(V, V, Z);
+      R.Cols.insert(R.Cols.end(), Z, 1U);
+    }
+
+    for (size_t I = 1UL; I < FB; ++I) {
+      uint32_t PI = P[I];
+
+      if (Root1[I] != ~0U) {
+        uint32_t IM = Idx % PI;
+        if (IM != Root1[I] && IM != Root2[I])
+          continue;
+      } else if (!mpz_divisible_ui_p(V, PI)) {
+        continue;
+      }
+
+      while (mpz_divisible_ui_p(V, PI)) {
+        mpz_divexact_ui(V, V, PI);
+        R.Cols.push_back((uint32_t) I + 1U);
+      }
+    }
+
+    if (mpz_cmp_ui(V, 1UL) != 0) {
+      if (mpz_size(V) > 1UL || mpz_get_ui(V) >= Job.LPMax)
+        return;
+      R.L = mpz_get_ui(V);
+    }
+
+    mpz_mul_si(Y, A, X);
+    mpz_add(Y, Y, B);
+    mpz_abs(Y, Y);
+    mpz_mod(Y, Y, Job.N);
+    StoreMPZ(R.Y, Y);
+
+    Found.push_back(std::move(R));
+  }
+
+  // Hands the relations of the last polynomial to the job. Returns true
+  // once the job has enough of them.
+  bool Publish() {
+    pthread_mutex_lock(&Job.Mutex);
+    ++Job.Polys;
+
+    for (size_t I = 0UL; I < Found.size(); ++I) {
+      siqs_relation& R = Found[I];
+
+      if (R.L == 1UL) {
+        Job.Rels.push_back(std::move(R));
+        continue;
+      }
+
+      std::unordered_map<uint64_t, uint32_t>::const_iterator PI =
+        Job.PartialIndex.find(R.L);
+
+      if (PI == Job.PartialIndex.end()) {
+        Job.PartialIndex.insert(std::make_pair(R.L,
+                                               (uint32_t) Job.Partials.size()));
+        Job.Partials.push_back(std::move(R));
+        continue;
+      }
+
+      // Two partials with the same large prime L make a relation with
+      // L^2 on the right side.
+      const siqs_relation& R0 = Job.Partials[PI->second];
+      if (R0.Y == R.Y)
+        continue;
+
+      siqs_relation RC;
+      LoadMPZ(T, R0.Y);
+      LoadMPZ(V, R.Y);
+      mpz_mul(T, T, V);
+      mpz_mod(T, T, Job.N);
+      StoreMPZ(RC.Y, T);
+      RC.Cols = R0.Cols;
+      RC.Cols.insert(RC.Cols.end(), R.Cols.begin(), R.Cols.end());
+      RC.L = R.L;
+      Job.Rels.push_back(std::move(RC));
+    }
+
+    bool Done = Job.Rels.size() >= Job.Need;
+    if (Done)
+      Job.Stop.store(true);
+
+    pthread_mutex_unlock(&Job.Mutex);
+
+    Found.clear();
+    return Done || Job.Stop.load(std::memory_order_relaxed);
+  }
+
+  siqs_job& Job;
+  mpz_t A;
+  mpz_t B;
+  mpz_t C;
+  mpz_t T;
+  mpz_t V;
+  mpz_t Y;
+  mpz_t* BJ;
+  std::vector<uint32_t> Q;
+  std::vector<int> Sgn;
+  std::vector<uint32_t> Root1;
+  std::vector<uint32_t> Root2;
+  std::vector<uint32_t> Next1;
+  std::vector<uint32_t> Next2;
+  std::vector<uint32_t> AInv;
+  std::vector<uint32_t> Bainv;
+  std::vector<uint8_t> NoSieve;
+  std::vector<uint8_t> Sieve;
+  std::vector<siqs_relation> Found;
+  uint64_t Rng;
+};
+
+extern "C" {
+  static void* siqs_thread_start(void* Arg) {
+    siqs_job& Job = *(siqs_job*) Arg;
+    SIQSWorker W(Job);
+    W.Run();
+    return NULL;
+  }
+}
+
+// A set of relations whose product is a square, except for the columns
+// in Odd.
+struct siqs_group {
+  std::vector<uint32_t> Rels;
+  std::vector<uint32_t> Odd;
+  bool Alive;
+};
+
+// Structured Gaussian elimination: drops groups that hold the only odd
+// entry of a column and merges the two groups of every column of weight
+// two, until neither applies. Both steps keep the excess of groups over
+// columns.
+static void ReduceMatrix(std::vector<siqs_group>& G, size_t Cols) {
+  std::vector<uint32_t> Weight(Cols);
+  std::vector<uint32_t> First(Cols);
+  std::vector<uint32_t> Second(Cols);
+  std::vector<uint8_t> Touched(G.size());
+  bool Changed = true;
+
+  while (Changed) {
+    Changed = false;
+    std::fill(Weight.begin(), Weight.end(), 0U);
+
+    for (uint32_t I = 0U; I < G.size(); ++I) {
+      if (!G[I].Alive)
+        continue;
+
+      for (size_t J = 0UL; J < G[I].Odd.size(); ++J) {
+        uint32_t C = G[I].Odd[J];
+        if (Weight[C] == 0U)
+          First[C] = I;
+        else if (Weight[C] == 1U)
+          Second[C] = I;
+        ++Weight[C];
+      }
+    }
+
+    std::fill(Touched.begin(), Touched.end(), 0U);
+
+    for (size_t C = 0UL; C < Cols; ++C) {
+      if (Weight[C] == 1U) {
+        if (G[First[C]].Alive && !Touched[First[C]]) {
+          G[First[C]].Alive = false;
+          Touched[First[C]] = 1U;
+          Changed = true;
+        }
+      } else if (Weight[C] == 2U) {
+        siqs_group& G1 = G[First[C]];
+        siqs_group& G2 = G[Second[C]];
+
+        if (!G1.Alive || !G2.Alive || Touched[First[C]] ||
+            Touched[Second[C]] ||
+            G1.Odd.size() + G2.Odd.size() > SIQSMergeWeight)
+          continue;
+
+        std::vector<uint32_t> X;
+        std::set_symmetric_difference(G1.Odd.begin(), G1.Odd.end(),
+                                      G2.Odd.begin(), G2.Odd.end(),
+                                      std::back_inserter(X));
+        G1.Odd.swap(X);
+        G1.Rels.insert(G1.Rels.end(), G2.Rels.begin(), G2.Rels.end());
+        G2.Alive = false;
+        Touched[First[C]] = Touched[Second[C]] = 1U;
+        Changed = true;
+      }
+    }
+  }
+}
+
+// Tries the dependencies of the relation matrix. Returns true and sets
+// F to a proper factor of N on success.
+static bool LinearAlgebra(siqs_job& Job, mpz_t& F) {
+  const std::vector<siqs_relation>& Rels = Job.Rels;
+  size_t Cols = Job.Primes.size() + 1UL;
+
+  std::vector<siqs_group> G(Rels.size());
+
+  for (uint32_t I = 0U; I < Rels.size(); ++I) {
+    std::vector<uint32_t> RC(Rels[I].Cols);
+    std::sort(RC.begin(), RC.end());
+
+    for (size_t J = 0UL; J < RC.size(); ) {
+      size_t K = J;
+      while (K < RC.size() && RC[K] == RC[J])
+        ++K;
+      if ((K - J) & 1UL)
+        G[I].Odd.push_back(RC[J]);
+      J = K;
+    }
+
+    G[I].Rels.push_back(I);
+    G[I].Alive = true;
+  }
+
+  ReduceMatrix(G, Cols);
+
+  // Renumber the columns that are left, and keep no more groups than
+  // columns + 64, the lightest ones.
+  std::vector<uint32_t> Row(Cols, ~0U);
+  std::vector<uint32_t> Live;
+  uint32_t Rows = 0U;
+
+  for (uint32_t I = 0U; I < G.size(); ++I) {
+    if (!G[I].Alive)
+      continue;
+
+    Live.push_back(I);
+    for (size_t J = 0UL; J < G[I].Odd.size(); ++J) {
+      if (Row[G[I].Odd[J]] == ~0U)
+        Row[G[I].Odd[J]] = Rows++;
+    }
+  }
+
+  if (Live.size() > (size_t) Rows + 64UL) {
+    std::stable_sort(Live.begin(), Live.end(),
+                     [&G](uint32_t X, uint32_t Y) {
+                       return G[X].Odd.size() < G[Y].Odd.size();
+                     });
+    Live.resize((size_t) Rows + 64UL);
+  }
+
+  size_t NG = Live.size();
+
+  if (Job.Verbose)
+    (void) std::fprintf(stderr, "SIQS: %lu relations, matrix %lu x %lu, "
+                        "%u x %lu after filtering.\n", Rels.size(), Cols,
+                        Rels.size(), Rows, NG);
+
+  if (NG <= Rows)
+    return false;
+
+  // Dense elimination of the Rows x NG matrix to reduced row echelon
+  // form. A free column f gives the null vector with f and, for every
+  // pivot row with a 1 in column f, that row's pivot column.
+  size_t WW = (NG + 63UL) / 64UL;
+  std::vector<uint64_t> Mat((size_t) Rows * WW, 0UL);
+
+  for (size_t K = 0UL; K < NG; ++K) {
+    const siqs_group& GK = G[Live[K]];
+    for (size_t J = 0UL; J < GK.Odd.size(); ++J)
+      Mat[(size_t) Row[GK.Odd[J]] * WW + K / 64UL] |= 1UL << (K % 64UL);
+  }
+
+  std::vector<uint32_t> PivotCol;
+  std::vector<uint8_t> IsPivot(NG, 0U);
+  size_t R = 0UL;
+
+  for (size_t K = 0UL; K < NG && R < Rows; ++K) {
+    size_t W = K / 64UL;
+    uint64_t B = 1UL << (K % 64UL);
+    size_t PR = R;
+
+    while (PR < Rows && !(Mat[PR * WW + W] & B))
+      ++PR;
+
+    if (PR == Rows)
+      continue;
+
+    if (PR != R)
+      std::swap_ranges(&Mat[PR * WW], &Mat[PR * WW] + WW, &Mat[R * WW]);
+
+    const uint64_t* RR = &Mat[R * WW];
+    for (size_t I = 0UL; I < Rows; ++I) {
+      uint64_t* RI = &Mat[I * WW];
+      if (I == R || !(RI[W] & B))
+        continue;
+
+      for (size_t J = W; J < WW; ++J)
+        RI[J] ^= RR[J];
+    }
+
+    PivotCol.push_back((uint32_t) K);
+    IsPivot[K] = 1U;
+    ++R;
+  }
+
+  mpz_t X;
+  mpz_t Y;
+  mpz_t Z;
+  mpz_init(X);
+  mpz_init(Y);
+  mpz_init(Z);
+
+  bool Success = false;
+  uint32_t Tried = 0U;
+  std::vector<uint32_t> Exp(Cols);
+
+  for (size_t FC = 0UL; FC < NG && Tried < 64U && !Success; ++FC) {
+    if (IsPivot[FC])
+      continue;
+
+    ++Tried;
+
+    std::vector<uint32_t> Dep(1, Live[FC]);
+    for (size_t I = 0UL; I < R; ++I) {
+      if (Mat[I * WW + FC / 64UL] & (1UL << (FC % 64UL)))
+        Dep.push_back(Live[PivotCol[I]]);
+    }
+
+    // X = prod Y_r, Y = sqrt(prod (A Q(x))_r), both mod N.
+    std::fill(Exp.begin(), Exp.end(), 0U);
+    mpz_set_ui(X, 1UL);
+    mpz_set_ui(Y, 1UL);
+
+    for (size_t D = 0UL; D < Dep.size(); ++D) {
+      const siqs_group& GD = G[Dep[D]];
+
+      for (size_t J = 0UL; J < GD.Rels.size(); ++J) {
+        const siqs_relation& RL = Rels[GD.Rels[J]];
+
+        LoadMPZ(Z, RL.Y);
+        mpz_mul(X, X, Z);
+        mpz_mod(X, X, Job.N);
+
+        if (RL.L != 1UL) {
+          mpz_mul_ui(Y, Y, RL.L);
+          mpz_mod(Y, Y, Job.N);
+        }
+
+        for (size_t K = 0UL; K < RL.Cols.size(); ++K)
+          ++Exp[RL.Cols[K]];
+      }
+    }
+
+    bool Square = true;
+    for (size_t C = 0UL; C < Cols && Square; ++C) {
+      if (Exp[C] & 1U)
+        Square = false;
+      else if (C > 0UL && Exp[C]) {
+        mpz_set_ui(Z, Job.Primes[C - 1UL]);
+        mpz_powm_ui(Z, Z, Exp[C] / 2U, Job.N);
+        mpz_mul(Y, Y, Z);
+        mpz_mod(Y, Y, Job.N);
+      }
+    }
+
+    if (!Square)
+      continue;
+
+    mpz_sub(Z, X, Y);
+    mpz_gcd(Z, Z, Job.N);
+
+    if (mpz_cmp_ui(Z, 1UL) > 0 && mpz_cmp(Z, Job.N) < 0) {
+      mpz_set(F, Z);
+      Success = true;
+    }
+  }
+
+  mpz_clear(Z);
+  mpz_clear(Y);
+  mpz_clear(X);
+
+  return Success;
+}
+
+bool SIQS(mpz_t& F, const mpz_t& N, uint32_t Threads, double Seconds,
+          bool Verbose) {
+  size_t Digits = mpz_sizeinbase(N, 10);
+  if (Digits < SIQSMinDigits || Digits > SIQSMaxDigits || mpz_even_p(N))
+    return false;
+
+  double Start = MonotonicSeconds();
+
+  siqs_job Job;
+  mpz_set(Job.N, N);
+  Job.Deadline = Start + Seconds;
+  Job.Verbose = Verbose;
+  Job.K = ChooseMultiplier(N);
+  mpz_mul_ui(Job.KN, N, Job.K);
+
+  // Interpolate the parameters on the digits of kN.
+  double D = (double) mpz_sizeinbase(Job.KN, 2) * std::log10(2.0);
+  size_t NP = sizeof(SIQSParams) / sizeof(SIQSParams[0]);
+  size_t PI = 1UL;
+  while (PI < NP - 1UL && SIQSParams[PI].Digits < D)
+    ++PI;
+
+  const siqs_params& P0 = SIQSParams[PI - 1UL];
+  const siqs_params& P1 = SIQSParams[PI];
+  double W = (D - P0.Digits) / (double) (P1.Digits - P0.Digits);
+  W = std::min(1.0, std::max(0.0, W));
+
+  uint32_t FBSize = (uint32_t) (P0.FBSize + W * (P1.FBSize - P0.FBSize));
+  Job.Blocks = (uint32_t) (P0.Blocks + W * (P1.Blocks - P0.Blocks) + 0.5);
+  uint32_t LPMult = (uint32_t) (P0.LPMult + W * (P1.LPMult - P0.LPMult));
+  Job.M = Job.Blocks * SIQSBlockSize;
+
+  if (!BuildFactorBase(Job, FBSize, F))
+    return true;
+
+  size_t FB = Job.Primes.size();
+  uint32_t PMax = Job.Primes.back();
+  Job.LPMax = (uint64_t) PMax * LPMult;
+
+  Job.NoSieve.assign(FB, 0U);
+  Job.SieveStart = 1U;
+  while (Job.SieveStart < FB && Job.Primes[Job.SieveStart] < SIQSSmallPrime)
+    ++Job.SieveStart;
+
+  for (size_t I = 0UL; I < FB; ++I) {
+    if (Job.Sqrt[I] == 0U)
+      Job.NoSieve[I] = 1U;
+  }
+
+  // |Q(x)| <= M sqrt(kN / 2) on [-M, M), but most values are well below
+  // that. Relations with one large prime below LPMax are kept, and the
+  // primes below SIQSSmallPrime are not sieved; the threshold allows for
+  // all three. The logarithms are scaled so that the threshold stays
+  // below 128: the byte of an index starts at 128 - threshold and a
+  // candidate has its high bit set.
+  double LogKN = (double) mpz_sizeinbase(Job.KN, 2);
+  double QBits = std::log2((double) Job.M) + LogKN / 2.0 - 0.5;
+  double TBits = QBits - std::log2((double) Job.LPMax) - SIQSThresholdSlack;
+  double Scale = TBits > 100.0 ? 100.0 / TBits : 1.0;
+
+  Job.Logp.resize(FB);
+  for (size_t I = 0UL; I < FB; ++I) {
+    double L = std::log2((double) Job.Primes[I]) * Scale + 0.5;
+    Job.Logp[I] = (uint8_t) std::max(1.0, L);
+  }
+
+  Job.Init = (uint8_t) (128.0 - TBits * Scale);
+  Job.LogTarget = (LogKN + 1.0) / 2.0 - std::log2((double) Job.M);
+
+  ChooseAShape(Job);
+
+  if (Verbose)
+    (void) std::fprintf(stderr, "SIQS: %lu digits, multiplier %u, factor base "
+                        "%lu primes up to %u, large primes up to %lu, "
+                        "%u x %u sieve, A of %u primes.\n", Digits, Job.K, FB,
+                        PMax, Job.LPMax, 2U * Job.Blocks, SIQSBlockSize, Job.S);
+
+  uint32_t NT = Threads ? Threads : 1U;
+  std::vector<pthread_t> TID(NT);
+  Job.Need = FB + 1UL + SIQSExcess;
+  bool Success = false;
+
+  for (;;) {
+    double SS = MonotonicSeconds();
+    Job.Stop.store(false);
+
+    for (uint32_t I = 0U; I < NT; ++I)
+      (void) pthread_create(&TID[I], NULL, siqs_thread_start, &Job);
+
+    for (uint32_t I = 0U; I < NT; ++I)
+      (void) pthread_join(TID[I], NULL);
+
+    double SE = MonotonicSeconds();
+
+    if (Verbose)
+      (void) std::fprintf(stderr, "SIQS: %lu relations (%lu partials) from "
+                          "%lu polynomials in %.3f seconds (%u threads).\n",
+                          Job.Rels.size(), Job.Partials.size(), Job.Polys,
+                          SE - SS, NT);
+
+    if (Job.Rels.size() < Job.Need)
+      break;
+
+    if (LinearAlgebra(Job, F)) {
+      Success = true;
+      break;
+    }
+
+    // Every dependency was trivial: sieve for more relations.
+    Job.Need += std::max((size_t) SIQSExcess, FB / 20UL);
+  }
+
+  if (Verbose)
+    (void) std::fprintf(stderr, "SIQS: %s in %.3f seconds.\n",
+                        Success ? "factor found" : "no factor",
+                        MonotonicSeconds() - Start);
+
+  return Success;
+}
@@ -0,0 +1,47 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#ifndef SIQS_H
+#define SIQS_H
+
+#include <cstdint>
+#include <gmp.h>
+
+// Self-initializing quadratic sieve (Contini, "Factoring integers with
+// the self-initializing quadratic sieve"), for odd composites of about
+// 30 to 125 digits that are not perfect powers and have no factor in the
+// factor base.
+//
+// - A Knuth-Schroeppel multiplier k is chosen, and the factor base holds
+//   the primes p with (kN / p) = 1.
+// - Every A = q_1 * ... * q_s of factor base primes yields 2^(s - 1)
+//   polynomials Q(x) = ((Ax + B)^2 - kN) / A, visited in Gray code order
+//   so that the roots of the next polynomial take one addition per prime.
+// - Threads sieve different A's over [-M, M) in blocks that fit in the
+//   L1 cache; relations with one large prime are kept and combined.
+// - The matrix is reduced by structured Gaussian elimination (singleton
+//   removal and merging of weight-2 rows), then solved densely over GF(2).
+
+static const uint32_t SIQSMinDigits = 30U;
+static const uint32_t SIQSMaxDigits = 125U;
+
+// Finds a proper factor F of N with Threads threads within Seconds of
+// wall-clock time. Progress goes to stderr if Verbose.
+bool SIQS(mpz_t& F, const mpz_t& N, uint32_t Threads, double Seconds,
+          bool Verbose);
+
+#endif // SIQS_H
@@ -0,0 +1,241 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "spftable.h"
+
+// Writes the smallest prime factor table of spftable.h. The table is
+// sieved in place in the mapped output file, one segment of entries per
+// step: the odd primes up to sqrt(Limit) mark their odd multiples from
+// p^2 on in decreasing order of p, so the smallest prime is written last.
+
+static const uint64_t SegmentEntries = 1UL << 17;
+
+struct spf_job {
+  spf_job() : Entry(NULL), Limit(0UL), Primes(), Segments(0UL), Next(0UL) { }
+
+  uint16_t* Entry;
+  uint64_t Limit;
+  std::vector<uint32_t> Primes;
+  uint64_t Segments;
+  std::atomic<uint64_t> Next;
+};
+
+static struct timespec ts_begin = { 0, 0 };
+static struct timespec ts_end = { 0, 0 };
+
+// The odd primes up to L by trial division by the previous ones.
+static void SmallOddPrimes(uint32_t L, std::vector<uint32_t>& Primes) {
+  for (uint32_t N = 3U; N <= L; N += 2U) {
+    bool P = true;
+
+    for (size_t I = 0UL; I < Primes.size(); ++I) {
+      uint32_t D = Primes[I];
+      if (D * D > N)
+        break;
+
+      if (N % D == 0U) {
+        P = false;
+        break;
+      }
+    }
+
+    if (P)
+      Primes.push_back(N);
+  }
+}
+
+static void SieveSegment(spf_job& J, uint64_t K) {
+  // Entries [Lo, Hi) are the odd n = 2 * I + 1 in [2 * Lo + 1, 2 * Hi - 1].
+  uint64_t Lo = K * SegmentEntries;
+  uint64_t Hi = Lo + SegmentEntries < J.Limit / 2UL ? Lo + SegmentEntries :
+    J.Limit / 2UL;
+  uint64_t NLo = 2UL * Lo + 1UL;
+  uint64_t NHi = 2UL * Hi - 1UL;
+  uint16_t* E = J.Entry;
+
+  std::memset(E + Lo, 0, (size_t) (Hi - Lo) * sizeof(uint16_t));
+
+  for (size_t I = J.Primes.size(); I-- > 0UL; ) {
+    uint64_t P = J.Primes[I];
+    if (P * P > NHi)
+      continue;
+
+    // The first odd multiple of P that is >= max(P^2, NLo).
+    uint64_t M = P * P;
+    if (M < NLo) {
+      M = (NLo + P - 1UL) / P * P;
+      if ((M & 1UL) == 0UL)
+        M += P;
+    }
+
+    for (uint64_t X = M >> 1; X < Hi; X += P)
+      E[X] = (uint16_t) P;
+  }
+}
+
+extern "C" {
+  static void* spf_thread_start(void* Arg) {
+    spf_job& J = *static_cast<spf_job*>(Arg);
+
+    for (;;) {
+      uint64_t K = J.Next.fetch_add(1UL, std::memory_order_relaxed);
+      if (K >= J.Segments)
+        break;
+
+      SieveSegment(J, K);
+    }
+
+    return NULL;
+  }
+}
+
+static void PrintUsage() {
+  std::cerr << "Usage: spftable -o <table-file>" << std::endl;
+  std::cerr << "                [ -n <limit> (odd n < limit, default "
+    << "4294967296 = 2^32)]" << std::endl;
+  std::cerr << "                [ -T <number-of-threads> (default all CPUs)]"
+    << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* Path = NULL;
+  uint64_t Limit = SPFMaxLimit;
+  uint32_t Threads = 0U;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ho:n:T:")) != -1) {
+    switch (opt) {
+    case 'o':
+      Path = optarg;
+      break;
+    case 'n':
+      Limit = (uint64_t) std::stoul(optarg);
+      break;
+    case 'T':
+      Threads = (uint32_t) std::stoul(optarg);
+      break;
+    case 'h':
+      PrintUsage();
+      return 0;
+    default:
+      PrintUsage();
+      return 1;
+    }
+  }
+
+  if (Path == NULL || optind != argc) {
+    PrintUsage();
+    return 1;
+  }
+
+  if (Limit < 3UL || Limit > SPFMaxLimit) {
+    std::cerr << "Error: The limit must be between 3 and 2^32!" << std::endl;
+    return 1;
+  }
+
+  if (Threads == 0U)
+    Threads = (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+  if (Threads == 0U)
+    Threads = 1U;
+
+  // Built under a temporary name and renamed, so that a reader never
+  // maps a partial table.
+  std::string Temp = std::string(Path) + ".tmp";
+  size_t Size = SPFTable::FileSize(Limit);
+
+  int FD = open(Temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (FD < 0) {
+    std::cerr << "Error: Could not create " << Temp << ": "
+      << std::strerror(errno) << std::endl;
+    return 1;
+  }
+
+  if (ftruncate(FD, (off_t) Size) != 0) {
+    std::cerr << "Error: Could not size " << Temp << ": "
+      << std::strerror(errno) << std::endl;
+    (void) close(FD);
+    (void) unlink(Temp.c_str());
+    return 1;
+  }
+
+  void* B = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, FD, 0);
+  (void) close(FD);
+
+  if (B == MAP_FAILED) {
+    std::cerr << "Error: Could not map " << Temp << ": "
+      << std::strerror(errno) << std::endl;
+    (void) unlink(Temp.c_str());
+    return 1;
+  }
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts_begin);
+
+  spf_job J;
+  J.Entry = reinterpret_cast<uint16_t*>(static_cast<char*>(B) +
+                                        sizeof(spf_header));
+  J.Limit = Limit;
+  J.Segments = (Limit / 2UL + SegmentEntries - 1UL) / SegmentEntries;
+
+  uint32_t R = 1U;
+  while ((uint64_t) (R + 1U) * (R + 1U) < Limit)
+    ++R;
+  SmallOddPrimes(R, J.Primes);
+
+  std::vector<pthread_t> TID(Threads);
+  for (uint32_t I = 0U; I < Threads; ++I)
+    (void) pthread_create(&TID[I], NULL, spf_thread_start, &J);
+
+  for (uint32_t I = 0U; I < Threads; ++I)
+    (void) pthread_join(TID[I], NULL);
+
+  spf_header H;
+  std::memcpy(H.Magic, SPFMagic, sizeof(SPFMagic));
+  H.Limit = Limit;
+  std::memcpy(B, &H, sizeof(H));
+
+  bool Ok = msync(B, Size, MS_SYNC) == 0;
+  (void) munmap(B, Size);
+
+  if (!Ok || rename(Temp.c_str(), Path) != 0) {
+    std::cerr << "Error: Could not write " << Path << ": "
+      << std::strerror(errno) << std::endl;
+    (void) unlink(Temp.c_str());
+    return 1;
+  }
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+  double S = (double) (ts_end.tv_sec - ts_begin.tv_sec) +
+    (double) (ts_end.tv_nsec - ts_begin.tv_nsec) / 1e9;
+  (void) std::fprintf(stderr, "%s: %lu entries (%lu bytes) in %.3f s\n",
+                      Path, (unsigned long) (Limit / 2UL),
+                      (unsigned long) Size, S);
+  return 0;
+}
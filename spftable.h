@@ -0,0 +1,136 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#ifndef SPFTABLE_H
+#define SPFTABLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Smallest prime factor table for the odd numbers below a limit of at
+// most 2^32, written by spftable and mapped read-only by primefactors.
+//
+// The file is a header followed by one 16-bit entry per odd n < Limit,
+// at index n / 2: the smallest prime factor of n, or 0 if n is 1 or
+// prime. Every composite n < 2^32 has a prime factor below 2^16, so the
+// whole range takes 2 bytes per odd number (4 GiB for 2^32). The table
+// is mapped MAP_SHARED, so concurrent processes share the pages of the
+// page cache, and an odd n is factored by following n -> n / spf(n).
+
+static const char SPFMagic[8] = { 'S', 'P', 'F', 'T', 'A', 'B', '1', '6' };
+static const uint64_t SPFMaxLimit = 1UL << 32;
+
+struct spf_header {
+  char Magic[8];
+  uint64_t Limit;
+};
+
+class SPFTable {
+public:
+  SPFTable() : Base(NULL), Size(0UL), Limit(0UL), Entry(NULL) { }
+
+  ~SPFTable() {
+    if (Base)
+      (void) munmap(Base, Size);
+  }
+
+  // Maps the table at Path. Returns false on an invalid file, with errno
+  // set for system errors and 0 otherwise.
+  bool Open(const char* Path) {
+    int FD = open(Path, O_RDONLY);
+    if (FD < 0)
+      return false;
+
+    struct stat ST;
+    if (fstat(FD, &ST) != 0 || (size_t) ST.st_size < sizeof(spf_header)) {
+      (void) close(FD);
+      errno = 0;
+      return false;
+    }
+
+    size_t S = (size_t) ST.st_size;
+    void* B = mmap(NULL, S, PROT_READ, MAP_SHARED, FD, 0);
+    (void) close(FD);
+
+    if (B == MAP_FAILED)
+      return false;
+
+    spf_header H;
+    std::memcpy(&H, B, sizeof(H));
+
+    if (std::memcmp(H.Magic, SPFMagic, sizeof(SPFMagic)) != 0 ||
+        H.Limit > SPFMaxLimit || S != FileSize(H.Limit)) {
+      (void) munmap(B, S);
+      errno = 0;
+      return false;
+    }
+
+    // Lookups jump around the table.
+    (void) madvise(B, S, MADV_RANDOM);
+
+    Base = B;
+    Size = S;
+    Limit = H.Limit;
+    Entry = reinterpret_cast<const uint16_t*>(
+      static_cast<const char*>(B) + sizeof(spf_header));
+    return true;
+  }
+
+  inline bool Covers(uint64_t N) const {
+    return N < Limit;
+  }
+
+  // Calls F(p) for every prime factor of the odd N < Limit, ascending
+  // and with multiplicity.
+  template<typename Fn>
+  inline void Factor(uint64_t N, Fn F) const {
+    while (N > 1UL) {
+      uint64_t P = Entry[N >> 1];
+
+      if (P == 0UL) {
+        F(N);
+        return;
+      }
+
+      F(P);
+      N /= P;
+    }
+  }
+
+  static inline size_t FileSize(uint64_t L) {
+    return sizeof(spf_header) + (size_t) (L / 2UL) * sizeof(uint16_t);
+  }
+
+private:
+  SPFTable(const SPFTable&) = delete;
+  SPFTable& operator=(const SPFTable&) = delete;
+
+  void* Base;
+  size_t Size;
+  uint64_t Limit;
+  const uint16_t* Entry;
+};
+
+#endif // SPFTABLE_H
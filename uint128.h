@@ -0,0 +1,329 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2019 Stefan Teleman.
+ */
+
+#ifndef UINT128_H
+#define UINT128_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+// Native 128-bit unsigned arithmetic for the numbers between 2^64 and
+// 2^128, shared by isprime (C) and primefactors (C++): decimal parsing
+// with overflow detection, Montgomery multiplication modulo an odd
+// 128-bit N with R = 2^128, Miller-Rabin and Brent's rho.
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+#define UINT128_MAX_DIGITS 39
+
+// Parses the decimal digits [B, E) into V. Returns false if there are
+// none, if there is anything else, or if the value exceeds 2^128 - 1.
+static inline bool ParseUInt128(const char* B, const char* E, uint128_t* V)
+{
+  const uint128_t Max = ~((uint128_t) 0U);
+  uint128_t R = 0U;
+
+  if (B == E)
+    return false;
+
+  for ( ; B < E; ++B) {
+    unsigned D = (unsigned) (*B - '0');
+    if (D > 9U)
+      return false;
+
+    if (R > (Max - D) / 10U)
+      return false;
+
+    R = R * 10U + D;
+  }
+
+  *V = R;
+  return true;
+}
+
+// Writes V in decimal to B, which holds UINT128_MAX_DIGITS characters,
+// and returns the end. Not NUL-terminated.
+static inline char* FormatUInt128(char* B, uint128_t V)
+{
+  char T[UINT128_MAX_DIGITS];
+  size_t L = 0UL;
+
+  do {
+    T[L++] = (char) ('0' + (unsigned) (V % 10U));
+    V /= 10U;
+  } while (V);
+
+  while (L)
+    *B++ = T[--L];
+
+  return B;
+}
+
+static inline unsigned Ctz128(uint128_t V)
+{
+  uint64_t L = (uint64_t) V;
+  return L ? (unsigned) __builtin_ctzl(L) :
+    64U + (unsigned) __builtin_ctzl((uint64_t) (V >> 64));
+}
+
+// Binary gcd; 128-bit division is a library call.
+static inline uint128_t GCD128(uint128_t A, uint128_t B)
+{
+  if (A == 0U)
+    return B;
+  if (B == 0U)
+    return A;
+
+  unsigned K = Ctz128(A | B);
+  A >>= Ctz128(A);
+
+  do {
+    B >>= Ctz128(B);
+
+    if (A > B) {
+      uint128_t T = A;
+      A = B;
+      B = T;
+    }
+
+    B -= A;
+  } while (B);
+
+  return A << K;
+}
+
+typedef struct montgomery128 {
+  uint128_t N;
+  uint128_t NInv;
+  uint128_t One;
+  uint128_t R2;
+} montgomery128;
+
+// A * B = H * 2^128 + L.
+static inline void Mul256(uint128_t A, uint128_t B, uint128_t* H,
+                          uint128_t* L)
+{
+  uint64_t A0 = (uint64_t) A;
+  uint64_t A1 = (uint64_t) (A >> 64);
+  uint64_t B0 = (uint64_t) B;
+  uint64_t B1 = (uint64_t) (B >> 64);
+
+  uint128_t P00 = (uint128_t) A0 * B0;
+  uint128_t P01 = (uint128_t) A0 * B1;
+  uint128_t P10 = (uint128_t) A1 * B0;
+  uint128_t P11 = (uint128_t) A1 * B1;
+
+  uint128_t Mid = (P00 >> 64) + (uint64_t) P01 + (uint64_t) P10;
+  *L = (Mid << 64) | (uint64_t) P00;
+  *H = P11 + (P01 >> 64) + (P10 >> 64) + (Mid >> 64);
+}
+
+// The high 128 bits of A * B.
+static inline uint128_t MulHigh128(uint128_t A, uint128_t B)
+{
+  uint64_t A0 = (uint64_t) A;
+  uint64_t A1 = (uint64_t) (A >> 64);
+  uint64_t B0 = (uint64_t) B;
+  uint64_t B1 = (uint64_t) (B >> 64);
+
+  uint128_t P00 = (uint128_t) A0 * B0;
+  uint128_t P01 = (uint128_t) A0 * B1;
+  uint128_t P10 = (uint128_t) A1 * B0;
+  uint128_t P11 = (uint128_t) A1 * B1;
+
+  uint128_t Mid = (P00 >> 64) + (uint64_t) P01 + (uint64_t) P10;
+  return P11 + (P01 >> 64) + (P10 >> 64) + (Mid >> 64);
+}
+
+static inline uint128_t Mont128Add(const montgomery128* M, uint128_t A,
+                                   uint128_t B)
+{
+  uint128_t S = A + B;
+  return (S < A || S >= M->N) ? S - M->N : S;
+}
+
+static inline uint128_t Mont128Sub(const montgomery128* M, uint128_t A,
+                                   uint128_t B)
+{
+  return A >= B ? A - B : A - B + M->N;
+}
+
+// A * B * R^-1 mod N for A, B < N. With T = A * B and U = T * N^-1
+// mod R, T - U * N is divisible by R and its low halves cancel.
+static inline uint128_t Mont128Mul(const montgomery128* M, uint128_t A,
+                                   uint128_t B)
+{
+  uint128_t TH;
+  uint128_t TL;
+  Mul256(A, B, &TH, &TL);
+
+  uint128_t U = TL * M->NInv;
+  uint128_t H = MulHigh128(U, M->N);
+
+  return TH >= H ? TH - H : TH - H + M->N;
+}
+
+// N odd.
+static inline void Mont128Init(montgomery128* M, uint128_t N)
+{
+  M->N = N;
+
+  // Newton's iteration; N is its own inverse to 3 bits.
+  M->NInv = N;
+  for (unsigned I = 0U; I < 6U; ++I)
+    M->NInv *= 2U - N * M->NInv;
+
+  // R mod N, then R^2 mod N by 128 doublings.
+  M->One = (((uint128_t) 0U) - N) % N;
+  M->R2 = M->One;
+  for (unsigned I = 0U; I < 128U; ++I)
+    M->R2 = Mont128Add(M, M->R2, M->R2);
+}
+
+static inline uint128_t Mont128ToMont(const montgomery128* M, uint128_t A)
+{
+  return Mont128Mul(M, A % M->N, M->R2);
+}
+
+static inline uint128_t Mont128Pow(const montgomery128* M, uint128_t A,
+                                   uint128_t E)
+{
+  uint128_t R = M->One;
+
+  while (E) {
+    if (E & 1U)
+      R = Mont128Mul(M, R, A);
+
+    A = Mont128Mul(M, A, A);
+    E >>= 1;
+  }
+
+  return R;
+}
+
+// Strong probable prime test with the first twenty primes as bases. It
+// is deterministic for N < 3317044064679887385961981 (about 2^81; the
+// first thirteen bases suffice, Sorenson and Webster), and above that no
+// composite is known that passes all twenty.
+static inline bool IsPrime128(uint128_t N)
+{
+  static const uint32_t Bases[] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61,
+    67, 71
+  };
+  static const uint128_t Deterministic13 =
+    (uint128_t) 3317044064679887UL * 1000000000UL + 385961981UL;
+
+  size_t NB = sizeof(Bases) / sizeof(Bases[0]);
+
+  if (N < 2U)
+    return false;
+
+  for (size_t I = 0UL; I < NB; ++I) {
+    if (N % Bases[I] == 0U)
+      return N == Bases[I];
+  }
+
+  if (N < 71U * 71U)
+    return true;
+
+  if (N < Deterministic13)
+    NB = 13UL;
+
+  montgomery128 M;
+  Mont128Init(&M, N);
+
+  uint128_t D = N - 1U;
+  unsigned S = Ctz128(D);
+  D >>= S;
+
+  uint128_t MinusOne = Mont128Sub(&M, 0U, M.One);
+
+  for (size_t I = 0UL; I < NB; ++I) {
+    uint128_t X = Mont128Pow(&M, Mont128ToMont(&M, Bases[I]), D);
+
+    if (X == M.One || X == MinusOne)
+      continue;
+
+    bool Composite = true;
+    for (unsigned J = 1U; J < S; ++J) {
+      X = Mont128Mul(&M, X, X);
+
+      if (X == MinusOne) {
+        Composite = false;
+        break;
+      }
+    }
+
+    if (Composite)
+      return false;
+  }
+
+  return true;
+}
+
+// Brent's variant of Pollard's rho, x -> x^2 + C, in Montgomery form,
+// with a gcd every 128 steps and a replay when a batch overshoots.
+// Returns a proper factor of the odd composite N, or N if this C failed.
+static inline uint128_t PollardBrent128(uint128_t N, uint128_t C)
+{
+  const uint128_t BatchSteps = 128U;
+
+  montgomery128 M;
+  Mont128Init(&M, N);
+
+  uint128_t MC = Mont128ToMont(&M, C);
+  uint128_t Y = Mont128ToMont(&M, 2U);
+  uint128_t X = Y;
+  uint128_t YS = Y;
+  uint128_t Q = M.One;
+  uint128_t G = 1U;
+
+  for (uint128_t R = 1U; G == 1U; R <<= 1) {
+    X = Y;
+
+    for (uint128_t I = 0U; I < R; ++I)
+      Y = Mont128Add(&M, Mont128Mul(&M, Y, Y), MC);
+
+    for (uint128_t K = 0U; K < R && G == 1U; K += BatchSteps) {
+      YS = Y;
+
+      uint128_t L = R - K < BatchSteps ? R - K : BatchSteps;
+      for (uint128_t I = 0U; I < L; ++I) {
+        Y = Mont128Add(&M, Mont128Mul(&M, Y, Y), MC);
+        Q = Mont128Mul(&M, Q, Mont128Sub(&M, X, Y));
+      }
+
+      G = GCD128(Q, N);
+    }
+  }
+
+  if (G == N) {
+    do {
+      YS = Mont128Add(&M, Mont128Mul(&M, YS, YS), MC);
+      G = GCD128(Mont128Sub(&M, X, YS), N);
+    } while (G == 1U);
+  }
+
+  return G;
+}
+
+#endif // UINT128_H